@@ -22,6 +22,7 @@
 #include "WProgram.h"
 
 #include "Messages.h"
+#include "SerialOutput.h"
 #include "SPI.h"
 
 #define AT25DF_DUMMY_BYTE 0x00
@@ -29,29 +30,38 @@
 #define AT25DF_STATUS_READ_COMMAND 0x05
 #define AT25DF_STATUS_WRITE_COMMAND 0x01
 #define AT25DF_CHIP_ERASE_COMMAND 0xc7
+#define AT25DF_BLOCK_ERASE_4K_COMMAND 0x20
+#define AT25DF_BLOCK_ERASE_32K_COMMAND 0x52
+#define AT25DF_BLOCK_ERASE_64K_COMMAND 0xd8
 #define AT25DF_WRITE_ENABLE_COMMAND 0x06
 #define AT25DF_WRITE_DISABLE_COMMAND 0x04
 #define AT25DF_READ_ARRAY_FAST_COMMAND 0x0b
 #define AT25DF_WRITE_SEQUENTIAL_COMMAND 0xad
+#define AT25DF_PAGE_PROGRAM_COMMAND 0x02
 
 #define AT25DF_STATUS_DONE_MASK 0x01
 
 #define AT25DF_TEST_BUFFER_SIZE 128
 #define AT25DF_TEST_REPEAT 128
 
-AT25DF::AT25DF(int ssPin)
+// the SS pin is fixed by AT25DF_SS_PIN in config.h, as it's selected by writing its port directly.
+AT25DF::AT25DF()
 {
-  _ssPin = ssPin;
+  _programPending = false;
+  _sequentialReadOpen = false;
+  _sequentialReadActive = false;
 }
 
 void AT25DF::setup()
 {
-  pinMode(_ssPin, OUTPUT);
+  pinMode(AT25DF_SS_PIN, OUTPUT);
+  deselect();
   writeEnableAndUnprotect();
 }
 
 void AT25DF::getManufacturerInfo(uint8_t* response)
 {
+  waitForPendingProgram();
   commandAndReadN(AT25DF_MANUFACTURER_INFO_COMMAND, response, 4);
 }
 
@@ -60,64 +70,209 @@ void AT25DF::printManufacturerInfo()
   byte buffer[4];
   getManufacturerInfo(buffer);
   printMessage(FLASH_MANU_MESSAGE);
-  Serial.print(buffer[0], HEX);
-  Serial.print(" ");
-  Serial.print(buffer[1], HEX);
-  Serial.print(" ");
-  Serial.print(buffer[2], HEX);
-  Serial.print(" ");
-  Serial.print(buffer[3], HEX);
-  Serial.print(" ");
-  Serial.println(" .");  
+  SerialOut.print(buffer[0], HEX);
+  SerialOut.print(" ");
+  SerialOut.print(buffer[1], HEX);
+  SerialOut.print(" ");
+  SerialOut.print(buffer[2], HEX);
+  SerialOut.print(" ");
+  SerialOut.print(buffer[3], HEX);
+  SerialOut.print(" ");
+  SerialOut.println(" .");  
 }
 
-void AT25DF::writeAddress(uint32_t address)
+// sends a command followed by a 24-bit address, most significant byte first
+void AT25DF::commandAndAddress(uint8_t command, uint32_t address)
 {
-  Spi.exchangeByte((uint8_t)((address & 0x00ff0000) >> 16));
-  Spi.exchangeByte((uint8_t)((address & 0x0000ff00) >> 8));
-  Spi.exchangeByte((uint8_t)(address & 0x000000ff));
+  uint8_t header[4];
+  header[0] = command;
+  header[1] = (uint8_t)((address & 0x00ff0000) >> 16);
+  header[2] = (uint8_t)((address & 0x0000ff00) >> 8);
+  header[3] = (uint8_t)(address & 0x000000ff);
+  Spi.transmit(header, 4);
 }
 
 void AT25DF::readArray(uint32_t startAddress, uint8_t* buffer, uint32_t num)
 {
-  Spi.assertSS(_ssPin);
-  Spi.exchangeByte(AT25DF_READ_ARRAY_FAST_COMMAND);
-  writeAddress(startAddress);
+  waitForPendingProgram();
+  select();
+  commandAndAddress(AT25DF_READ_ARRAY_FAST_COMMAND, startAddress);
   Spi.exchangeByte(AT25DF_DUMMY_BYTE);
-  for (int i = 0; i < num; i++ )
-    buffer[i] = Spi.exchangeByte(AT25DF_DUMMY_BYTE);
-  Spi.deassertSS(_ssPin);
+  Spi.receive(buffer, num);
+  deselect();
+}
+
+// A sequential read keeps a single fast read command going, so that data can be streamed out of
+// the flash without sending the command and address for every entry. The read isn't actually
+// started until data is asked for. If any other flash command is sent while a sequential read is
+// open then the read is suspended, and picked up again where it left off by the next call to
+// sequentialRead().
+void AT25DF::startSequentialRead(uint32_t startAddress)
+{
+  suspendSequentialRead();
+  _sequentialReadAddress = startAddress;
+  _sequentialReadOpen = true;
+}
+
+void AT25DF::sequentialRead(uint8_t* buffer, uint32_t num)
+{
+  if (!_sequentialReadOpen) return;
+  if (!_sequentialReadActive)
+  {
+    waitForPendingProgram();
+    SPI_FAST_ASSERT_SS(AT25DF_SS_PORT, AT25DF_SS_BIT);
+    commandAndAddress(AT25DF_READ_ARRAY_FAST_COMMAND, _sequentialReadAddress);
+    Spi.exchangeByte(AT25DF_DUMMY_BYTE);
+    _sequentialReadActive = true;
+  }
+  Spi.receive(buffer, num);
+  _sequentialReadAddress += num;
+}
+
+void AT25DF::endSequentialRead()
+{
+  suspendSequentialRead();
+  _sequentialReadOpen = false;
+}
+
+void AT25DF::suspendSequentialRead()
+{
+  if (!_sequentialReadActive) return;
+  SPI_FAST_DEASSERT_SS(AT25DF_SS_PORT, AT25DF_SS_BIT);
+  _sequentialReadActive = false;
+}
+
+// all commands, other than the sequential read, select the flash through these. The SS pin is
+// driven directly through its port, as digitalWrite is slow enough to be a large fraction of the
+// time taken by short commands.
+void AT25DF::select()
+{
+  suspendSequentialRead();
+  SPI_FAST_ASSERT_SS(AT25DF_SS_PORT, AT25DF_SS_BIT);
+}
+
+void AT25DF::deselect()
+{
+  SPI_FAST_DEASSERT_SS(AT25DF_SS_PORT, AT25DF_SS_BIT);
 }
 
 void AT25DF::writeArray(uint32_t startAddress, uint8_t* buffer, uint32_t num)
 {
+  waitForPendingProgram();
   writeEnableAndUnprotect();
-  Spi.assertSS(_ssPin);
-  Spi.exchangeByte(AT25DF_WRITE_SEQUENTIAL_COMMAND);
-  writeAddress(startAddress);
+  select();
+  commandAndAddress(AT25DF_WRITE_SEQUENTIAL_COMMAND, startAddress);
   // clock in the first byte of data
   Spi.exchangeByte(buffer[0]);
-  Spi.deassertSS(_ssPin);
+  deselect();
   waitUntilDone();  
   // and the rest
   for (int i = 1; i < num; i++)
   {
-    Spi.assertSS(_ssPin);
+    select();
     Spi.exchangeByte(AT25DF_WRITE_SEQUENTIAL_COMMAND);
     Spi.exchangeByte(buffer[i]);
-    Spi.deassertSS(_ssPin);
+    deselect();
     waitUntilDone();
   }
   writeDisable();
 }
 
+// programs up to a page of data with a single page program command, so there's only one wait for the
+// flash to finish, rather than one per byte as with writeArray. The data must not cross a page boundary,
+// as the flash wraps around to the start of the page if it does.
+void AT25DF::writePage(uint32_t startAddress, uint8_t* buffer, uint16_t num)
+{
+  startPageProgram(startAddress, buffer, num);
+  waitForPendingProgram();
+  writeDisable();
+}
+
+// this starts a page program, but doesn't wait for it to finish. Once the data has been clocked in
+// the buffer can be reused, and the flash gets on with programming by itself. isBusy() can be used
+// to find out when it's done. Any other flash operation will wait for the program to finish first.
+void AT25DF::startPageProgram(uint32_t startAddress, uint8_t* buffer, uint16_t num)
+{
+  waitForPendingProgram();
+  writeEnableAndUnprotect();
+  select();
+  commandAndAddress(AT25DF_PAGE_PROGRAM_COMMAND, startAddress);
+  Spi.transmit(buffer, num);
+  deselect();
+  _programPending = true;
+}
+
+// returns whether a program started by startPageProgram is still in progress. The status register
+// is only read if there's a program pending, so this is cheap to call when the flash is idle.
+boolean AT25DF::isBusy()
+{
+  if (!_programPending) return false;
+  if (readStatusRegister() & AT25DF_STATUS_DONE_MASK) return true;
+  _programPending = false;
+  return false;
+}
+
+void AT25DF::waitForPendingProgram()
+{
+  if (!_programPending) return;
+  waitUntilDone();
+  _programPending = false;
+}
+
+// starts erasing the 4K block that the address is in. Like startPageProgram() this doesn't wait
+// for the erase to finish, which takes a good deal longer than programming a page.
+void AT25DF::startBlockErase(uint32_t address)
+{
+  startErase(AT25DF_BLOCK_ERASE_4K_COMMAND, address);
+}
+
+// erases the 4K blocks that the range from startAddress up to endAddress is in. The bigger block
+// erases are a good deal quicker per byte, so each step uses the biggest one that starts where we are
+// and doesn't go past the end of the range. A dot is printed for each step, as this can still take a
+// few seconds if there's a lot to erase.
+void AT25DF::eraseRange(uint32_t startAddress, uint32_t endAddress)
+{
+  uint32_t address = startAddress - (startAddress % AT25DF_BLOCK_SIZE);
+  while (address < endAddress)
+  {
+    uint32_t remaining = endAddress - address;
+    uint32_t blockSize = AT25DF_BLOCK_SIZE;
+    uint8_t command = AT25DF_BLOCK_ERASE_4K_COMMAND;
+    if ((address % 65536) == 0 && remaining >= 65536)
+    {
+      blockSize = 65536;
+      command = AT25DF_BLOCK_ERASE_64K_COMMAND;
+    }
+    else if ((address % 32768) == 0 && remaining >= 32768)
+    {
+      blockSize = 32768;
+      command = AT25DF_BLOCK_ERASE_32K_COMMAND;
+    }
+    startErase(command, address);
+    waitForPendingProgram();
+    SerialOut.print(".");
+    address += blockSize;
+  }
+}
+
 void AT25DF::chipErase()
 {
+  waitForPendingProgram();
   writeEnableAndUnprotect();
   command(AT25DF_CHIP_ERASE_COMMAND);
   waitUntilDone();
 }
 
+void AT25DF::startErase(uint8_t command, uint32_t address)
+{
+  waitForPendingProgram();
+  writeEnableAndUnprotect();
+  select();
+  commandAndAddress(command, address);
+  deselect();
+  _programPending = true;
+}
+
 void AT25DF::writeEnableAndUnprotect()
 {
   uint8_t comm = 0x00;
@@ -144,20 +299,18 @@ void AT25DF::waitUntilDone()
 
 void AT25DF::commandAndReadN(uint8_t command, uint8_t* buffer, int n)
 {
-  Spi.assertSS(_ssPin);
+  select();
   Spi.exchangeByte(command);
-  for (int i = 0; i < n; i++)
-    buffer[i] = Spi.exchangeByte(AT25DF_DUMMY_BYTE);
-  Spi.deassertSS(_ssPin);
+  Spi.receive(buffer, n);
+  deselect();
 }
 
 void AT25DF::commandAndWriteN(uint8_t command, uint8_t* data, int n)
 {
-  Spi.assertSS(_ssPin);
+  select();
   Spi.exchangeByte(command);
-  for (int i = 0; i < n; i++)
-    Spi.exchangeByte(data[i]);
-  Spi.deassertSS(_ssPin);
+  Spi.transmit(data, n);
+  deselect();
 }
 
 void AT25DF::command(uint8_t command)
@@ -168,18 +321,56 @@ void AT25DF::command(uint8_t command)
 
 void AT25DF::test()
 {
+  // the test only uses the start of the flash, so only that needs erasing
+  const uint32_t testSize = (uint32_t)AT25DF_TEST_BUFFER_SIZE * AT25DF_TEST_REPEAT;
   printMessage(FLASH_TEST_MESSAGE);
   printMessage(ERASING_MESSAGE);
-  chipErase();
+  eraseRange(0, testSize);
   printMessage(DONE_MESSAGE);
   
   printMessage(WRITING_MESSAGE);
   uint8_t bufferW[AT25DF_TEST_BUFFER_SIZE];
   for (int i = 0; i < AT25DF_TEST_BUFFER_SIZE; i++) bufferW[i] = 0;
+  uint32_t startTime = millis();
   for (uint32_t i = 0; i < AT25DF_TEST_REPEAT; i++) writeArray(i * AT25DF_TEST_BUFFER_SIZE, bufferW, AT25DF_TEST_BUFFER_SIZE);
+  uint32_t sequentialTime = millis() - startTime;
   printMessage(DONE_MESSAGE);
   
   printMessage(READING_MESSAGE);
+  boolean passed = verifyTestBlocks();
+  printMessage(DONE_MESSAGE);
+  printMessage(ERASING_MESSAGE);
+  eraseRange(0, testSize);
+  printMessage(DONE_MESSAGE);
+
+  // write the same data again with page programming, so we can compare the throughput. The test
+  // buffer is smaller than a page, and divides into it, so no write crosses a page boundary.
+  printMessage(WRITING_MESSAGE);
+  startTime = millis();
+  for (uint32_t i = 0; i < AT25DF_TEST_REPEAT; i++) writePage(i * AT25DF_TEST_BUFFER_SIZE, bufferW, AT25DF_TEST_BUFFER_SIZE);
+  uint32_t pageTime = millis() - startTime;
+  printMessage(DONE_MESSAGE);
+
+  printMessage(READING_MESSAGE);
+  passed &= verifyTestBlocks();
+  printMessage(DONE_MESSAGE);
+  printMessage(ERASING_MESSAGE);
+  eraseRange(0, testSize);
+  printMessage(DONE_MESSAGE);
+
+  printMessage(FLASH_SEQUENTIAL_WRITE_RATE_MESSAGE);
+  printRate(testSize, sequentialTime);
+  printMessage(FLASH_PAGE_WRITE_RATE_MESSAGE);
+  printRate(testSize, pageTime);
+
+  if (passed) printMessage(TEST_PASS_MESSAGE);
+  else printMessage(TEST_FAIL_MESSAGE);
+}
+
+// reads back the blocks written by the test, which should all be zero.
+boolean AT25DF::verifyTestBlocks()
+{
+  boolean ok = true;
   uint8_t bufferR[AT25DF_TEST_BUFFER_SIZE];
   uint32_t checksum;
   for (uint32_t j = 0; j < AT25DF_TEST_REPEAT; j++)
@@ -189,17 +380,18 @@ void AT25DF::test()
     for (int i = 0; i < AT25DF_TEST_BUFFER_SIZE; i++) checksum += bufferR[i];
     if (checksum != 0)
     {
-      Serial.print("Error in flash, test block ");
-      Serial.println(j);
-      printMessage(TEST_FAIL_MESSAGE);
+      printMessage(FLASH_TEST_BLOCK_ERROR_MESSAGE);
+      SerialOut.println(j);
+      ok = false;
     }
   }
-  printMessage(DONE_MESSAGE);
-  printMessage(ERASING_MESSAGE);
-  chipErase();
-  printMessage(DONE_MESSAGE);
-  printMessage(TEST_PASS_MESSAGE);
+  return ok;
 }
 
-
-
+void AT25DF::printRate(uint32_t bytes, uint32_t timeMS)
+{
+  // guard against a zero time, which would be a very fast flash indeed
+  if (timeMS == 0) timeMS = 1;
+  SerialOut.print((bytes * 1000) / timeMS);
+  printMessage(BYTES_PER_SECOND_MESSAGE);
+}
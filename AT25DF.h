@@ -24,16 +24,32 @@
 #include "config.h"
 
 #define AT25DF_SIZE 524288
+#define AT25DF_PAGE_SIZE 256
+#define AT25DF_BLOCK_SIZE 4096
+// typical time for the flash to program a page, and how often to poll it after that if it's still busy
+#define AT25DF_PAGE_PROGRAM_TIME_US 1500
+#define AT25DF_STATUS_POLL_INTERVAL_US 250
+// typical time for the flash to erase a 4K block
+#define AT25DF_BLOCK_ERASE_TIME_US 50000
 
 class AT25DF
 {
   public:
-    AT25DF(int ssPin);
+    AT25DF();
     void setup();
     void getManufacturerInfo(uint8_t* response);
     void printManufacturerInfo();
     void readArray(uint32_t startAddress, uint8_t* buffer, uint32_t num);
+    void startSequentialRead(uint32_t startAddress);
+    void sequentialRead(uint8_t* buffer, uint32_t num);
+    void endSequentialRead();
     void writeArray(uint32_t startAddress, uint8_t* buffer, uint32_t num);
+    void writePage(uint32_t startAddress, uint8_t* buffer, uint16_t num);
+    void startPageProgram(uint32_t startAddress, uint8_t* buffer, uint16_t num);
+    boolean isBusy();
+    void waitForPendingProgram();
+    void startBlockErase(uint32_t address);
+    void eraseRange(uint32_t startAddress, uint32_t endAddress);
     void chipErase();
     uint8_t readStatusRegister();
     void waitUntilDone();
@@ -41,11 +57,22 @@ class AT25DF
     void writeDisable();
     void test();
   private:
-    int _ssPin;
+    boolean _programPending;
+    // the state of the sequential read: whether one has been started, whether the read command
+    // is currently running on the flash, and the next address it will read.
+    boolean _sequentialReadOpen;
+    boolean _sequentialReadActive;
+    uint32_t _sequentialReadAddress;
+    void suspendSequentialRead();
+    void select();
+    void deselect();
     void commandAndReadN(uint8_t command, uint8_t* buffer, int n);
     void commandAndWriteN(uint8_t command, uint8_t* buffer, int n);
     void command(uint8_t command);
-    void writeAddress(uint32_t address);
+    void commandAndAddress(uint8_t command, uint32_t address);
+    void startErase(uint8_t command, uint32_t address);
+    boolean verifyTestBlocks();
+    void printRate(uint32_t bytes, uint32_t timeMS);
 };
 
 #endif /*AT25DF_H*/
@@ -0,0 +1,58 @@
+/*
+    openaltimeter -- an open-source altimeter for RC aircraft
+    Copyright (C) 2010  Jony Hudson
+    http://openaltimeter.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// generated by tools/altitudetable.py, which describes the table. Only BMP085.cpp should include this.
+
+#ifndef ALTITUDETABLE_H
+#define ALTITUDETABLE_H
+
+#include <avr/pgmspace.h>
+
+#define ALTITUDE_TABLE_MIN_PRESSURE 30000
+#define ALTITUDE_TABLE_MAX_PRESSURE 110384
+#define ALTITUDE_TABLE_SHIFT 9
+#define ALTITUDE_TABLE_LENGTH 158
+#define ALTITUDE_STANDARD_PRESSURE 101325
+
+// the height in mm of each pressure above the standard pressure
+int32_t _altitudeTable[ALTITUDE_TABLE_LENGTH] PROGMEM =
+{
+  9172912, 9059405, 8947429, 8836940, 8727893, 8620248, 8513965, 8409005,
+  8305332, 8202913, 8101712, 8001700, 7902843, 7805114, 7708484, 7612926,
+  7518412, 7424919, 7332422, 7240898, 7150323, 7060677, 6971938, 6884085,
+  6797100, 6710964, 6625657, 6541163, 6457465, 6374545, 6292388, 6210979,
+  6130301, 6050342, 5971086, 5892520, 5814630, 5737404, 5660830, 5584895,
+  5509587, 5434894, 5360807, 5287313, 5214402, 5142065, 5070291, 4999070,
+  4928393, 4858250, 4788634, 4719534, 4650943, 4582853, 4515254, 4448140,
+  4381502, 4315334, 4249627, 4184375, 4119570, 4055207, 3991277, 3927776,
+  3864695, 3802030, 3739774, 3677922, 3616466, 3555402, 3494725, 3434428,
+  3374507, 3314956, 3255770, 3196945, 3138475, 3080355, 3022582, 2965150,
+  2908055, 2851292, 2794857, 2738747, 2682956, 2627482, 2572319, 2517464,
+  2462913, 2408663, 2354709, 2301049, 2247678, 2194594, 2141792, 2089269,
+  2037023, 1985049, 1933345, 1881908, 1830734, 1779821, 1729165, 1678764,
+  1628615, 1578715, 1529062, 1479652, 1430482, 1381552, 1332857, 1284395,
+  1236164, 1188162, 1140385, 1092832, 1045500, 998387, 951491, 904809,
+  858340, 812080, 766029, 720184, 674543, 629103, 583864, 538822,
+  493977, 449325, 404866, 360598, 316518, 272624, 228916, 185391,
+  142048, 98885, 55900, 13092, -29542, -72002, -114290, -156407,
+  -198356, -240138, -281754, -323205, -364494, -405621, -446588, -487396,
+  -528047, -568542, -608883, -649070, -689105, -728990
+};
+
+#endif /*ALTITUDETABLE_H*/
@@ -32,14 +32,32 @@
 #include "WProgram.h"
 
 #include <Wire.h>
+#include <avr/interrupt.h>
 
 #include "Messages.h"
+#include "SerialOutput.h"
+#include "AltitudeTable.h"
+
+// set by the EOC pin change interrupt when a conversion finishes. The results can't be read in the
+// interrupt, as the I2C library needs interrupts itself, so service() picks them up.
+volatile boolean _bmp085ConversionDone;
+
+ISR(BMP085_EOC_vect)
+{
+  if (digitalRead(BMP085_EOC_PIN) == HIGH) _bmp085ConversionDone = true;
+}
+
+uint16_t _bmp085PressureConversionTimes[] = BMP085_PRESSURE_CONVERSION_US;
 
 BMP085::BMP085(int xclrPin, int eocPin, int oversampling)
 {
   _xclrPin = xclrPin;
   _eocPin = eocPin;
   _oversampling = oversampling;
+  _state = BMP085_IDLE;
+  _temperatureInterval = 0;
+  _haveTemperature = false;
+  _climbFilter = 0;
 }
 
 void BMP085::setup()
@@ -47,21 +65,29 @@ void BMP085::setup()
   if (_xclrPin != 0) pinMode(_xclrPin, OUTPUT);
   pinMode(_eocPin, INPUT);
   digitalWrite(_eocPin, LOW);
+  if (_eocPin != 0)
+  {
+    BMP085_EOC_PCMSK |= _BV(BMP085_EOC_PCINT);
+    PCICR |= _BV(BMP085_EOC_PCIE);
+  }
   enable();
   // let the sensor stabilise
   delay(20);
-  // get the calibration constants from the sensor
-  _ac1 = read16bit(0xAA);
-  _ac2 = read16bit(0xAC);
-  _ac3 = read16bit(0xAE);
-  _ac4 = read16bit(0xB0);
-  _ac5 = read16bit(0xB2);
-  _ac6 = read16bit(0xB4);
-  _b1 = read16bit(0xB6);
-  _b2 = read16bit(0xB8);
-  _mb = read16bit(0xBA);
-  _mc = read16bit(0xBC);
-  _md = read16bit(0xBE);
+  // get the calibration constants from the sensor, all in one go. They're big-endian 16-bit values,
+  // in this order.
+  uint8_t c[BMP085_CALIBRATION_LENGTH];
+  readBytes(BMP085_CALIBRATION_REGISTER, c, BMP085_CALIBRATION_LENGTH);
+  _ac1 = (c[0] << 8) | c[1];
+  _ac2 = (c[2] << 8) | c[3];
+  _ac3 = (c[4] << 8) | c[5];
+  _ac4 = (c[6] << 8) | c[7];
+  _ac5 = (c[8] << 8) | c[9];
+  _ac6 = (c[10] << 8) | c[11];
+  _b1 = (c[12] << 8) | c[13];
+  _b2 = (c[14] << 8) | c[15];
+  _mb = (c[16] << 8) | c[17];
+  _mc = (c[18] << 8) | c[19];
+  _md = (c[20] << 8) | c[21];
 }
 
 void BMP085::enable()
@@ -86,9 +112,16 @@ void BMP085::update()
 }
 
 void BMP085::calculate()
-{    
-  int32_t x1, x2, x3, b3, b5, b6, p;
-  uint32_t b4, b7;
+{
+  calculateTemperature();
+  calculatePressure();
+}
+
+// works out the temperature from the raw temperature reading, along with the terms of the pressure
+// calculation that depend on it, which are kept until the temperature is next measured.
+void BMP085::calculateTemperature()
+{
+  int32_t x1, x2, x3, b5, b6;
 
   x1 = (_ut - _ac6) * _ac5 >> 15;
   x2 = ((int32_t) _mc << 11) / (x1 + _md);
@@ -99,88 +132,162 @@ void BMP085::calculate()
   x1 = (_b2 * (b6 * b6 >> 12)) >> 11; 
   x2 = _ac2 * b6 >> 11;
   x3 = x1 + x2;
-  b3 = (((int32_t) _ac1 * 4 + x3) << _oversampling) >> 2;
+  _b3 = (((int32_t) _ac1 * 4 + x3) << _oversampling) >> 2;
   x1 = _ac3 * b6 >> 13;
   x2 = (_b1 * (b6 * b6 >> 12)) >> 16;
   x3 = ((x1 + x2) + 2) >> 2;
-  b4 = (_ac4 * (uint32_t) (x3 + 32768)) >> 15;
-  b7 = ((uint32_t) _up - b3) * (50000 >> _oversampling);
-  p = b7 < 0x80000000 ? (b7 * 2) / b4 : (b7 / b4) * 2;
+  _b4 = (_ac4 * (uint32_t) (x3 + 32768)) >> 15;
+}
+
+void BMP085::calculatePressure()
+{
+  pressure = compensatePressure(_up);
+}
+
+// the pressure in Pa for a raw pressure reading, at the last temperature that was measured
+int32_t BMP085::compensatePressure(uint32_t up)
+{
+  int32_t x1, x2, p;
+  uint32_t b7;
+
+  b7 = (up - _b3) * (50000 >> _oversampling);
+  p = b7 < 0x80000000 ? (b7 * 2) / _b4 : (b7 / _b4) * 2;
   x1 = (p >> 8) * (p >> 8);
   x1 = (x1 * 3038) >> 16;
   x2 = (-7357 * p) >> 16;
-  pressure = p + ((x1 + x2 + 3791) >> 4);
+  return p + ((x1 + x2 + 3791) >> 4);
 }
 
 void BMP085::updateRawTemperature()
 {
-  write8bit(0xf4, 0x2e);
-  if (_eocPin == 0) delay(5);
-  else { 
-    while (digitalRead(_eocPin) != HIGH) {
-    } 
-  }
+  startTemperatureConversion();
+  while (!isConversionDone()) {}
   _ut = read16bit(0xf6);
 }
 
 void BMP085::updateRawPressure()
 {
-  write8bit(0xf4, 0x34 + (_oversampling << 6));
-  if (_eocPin == 0)
+  startPressureConversion();
+  while (!isConversionDone()) {}
+  _up = read24bit(0xf6) >> (8 - _oversampling);
+}
+
+void BMP085::softOversample(int ost, int osp)
+{
+  startOversample(ost, osp);
+  while (!service()) {}
+}
+
+// starts averaging ost temperature readings, if the temperature is due to be measured, and then osp
+// pressure readings. Any oversampling that was already going on is abandoned.
+void BMP085::startOversample(uint8_t ost, uint8_t osp)
+{
+  _ost = ost;
+  _osp = osp;
+  _sum = 0;
+  if (!_haveTemperature || millis() - _temperatureTime >= _temperatureInterval)
   {
-    switch (_oversampling)
-    {
-    case 0:
-      delay(5);
-      break;
-    case 1:
-      delay(8);
-      break;
-    case 2:
-      delay(14);
-      break;
-    default:
-      delay(26);
-      break;
-    }      
+    _conversionsLeft = ost;
+    _state = BMP085_SAMPLING_TEMPERATURE;
+    startTemperatureConversion();
   }
-  else { 
-    while (digitalRead(_eocPin) != HIGH) {
-    } 
+  else
+  {
+    _conversionsLeft = osp;
+    _state = BMP085_SAMPLING_PRESSURE;
+    startPressureConversion();
   }
-  _up = read24bit(0xf6) >> (8 - _oversampling);
 }
 
-void BMP085::softOversample(int ost, int osp)
+// reads the conversion that's just finished, if there is one, and starts the next.
+boolean BMP085::service()
 {
-  uint32_t avUT = 0;
-  for (int i = 0 ; i < ost ; i++)
+  if (_state == BMP085_IDLE || !isConversionDone()) return false;
+  if (_state == BMP085_SAMPLING_TEMPERATURE)
   {
-    updateRawTemperature();
-    avUT += _ut;
+    _sum += read16bit(0xf6);
+    if (--_conversionsLeft > 0)
+    {
+      startTemperatureConversion();
+      return false;
+    }
+    _ut = _sum / _ost;
+    calculateTemperature();
+    _temperatureTime = millis();
+    _haveTemperature = true;
+    _sum = 0;
+    _conversionsLeft = _osp;
+    _state = BMP085_SAMPLING_PRESSURE;
+    startPressureConversion();
+    return false;
   }
-  _ut = avUT / ost;
-  
-  uint32_t avUP = 0;
-  for (int i = 0 ; i < osp ; i++)
+  uint32_t up = read24bit(0xf6) >> (8 - _oversampling);
+  _sum += up;
+  // the climb filter gets every conversion, not just the average
+  if (_climbFilter != 0) _climbFilter->add(compensatePressure(up), millis());
+  if (--_conversionsLeft > 0)
   {
-    updateRawPressure();
-    avUP += _up;
+    startPressureConversion();
+    return false;
   }
-  _up = avUP / osp;
-  calculate();
+  _up = _sum / _osp;
+  _state = BMP085_IDLE;
+  calculatePressure();
+  return true;
+}
+
+boolean BMP085::isSampling()
+{
+  return (_state != BMP085_IDLE);
+}
+
+void BMP085::setTemperatureInterval(uint32_t intervalMS)
+{
+  _temperatureInterval = intervalMS;
+}
+
+void BMP085::setClimbFilter(ClimbFilter* climbFilter)
+{
+  _climbFilter = climbFilter;
+}
+
+void BMP085::startTemperatureConversion()
+{
+  startConversion(0x2e, BMP085_TEMPERATURE_CONVERSION_US);
+}
+
+void BMP085::startPressureConversion()
+{
+  startConversion(0x34 + (_oversampling << 6), _bmp085PressureConversionTimes[_oversampling]);
+}
+
+void BMP085::startConversion(uint8_t command, uint16_t conversionTime)
+{
+  _bmp085ConversionDone = false;
+  write8bit(0xf4, command);
+  _conversionStartTime = micros();
+  _conversionTime = conversionTime;
+}
+
+// the EOC pin goes high when the conversion is done. Without it, we go by the time from the data sheet.
+boolean BMP085::isConversionDone()
+{
+  if (_eocPin != 0 && _bmp085ConversionDone) return true;
+  return (micros() - _conversionStartTime > _conversionTime);
 }
 
 // sets the base pressure which is used to calculate alititude changes
 void BMP085::setBasePressure()
 {
   softOversample(ALTIMETER_OST, ALTIMETER_OSP);
-  _basePressure = pressure;
+  setBasePressure(pressure);
 }
 
 void BMP085::setBasePressure(int32_t pressure)
 {
   _basePressure = pressure;
+  _baseHeight = lookupHeight(pressure);
+  _altitudeScale = (uint16_t)(32768.0 * pow((double)ALTITUDE_STANDARD_PRESSURE / (double)pressure, 1.0 / 5.25) + 0.5);
 }
 
 uint32_t BMP085::getBasePressure()
@@ -192,38 +299,76 @@ uint32_t BMP085::getBasePressure()
 // those who live up mountains!)
 float BMP085::convertToAltitude(uint32_t pressure, float heightUnits)
 {
-  return heightUnits * 44330.0 * (1.0 - pow((double)pressure / (double)_basePressure, 1.0 / 5.25));
+  return (float)convertToAltitudeMM(pressure) * (heightUnits * 0.001);
+}
+
+// this is 44330 * (1 - (pressure / basePressure)^(1/5.25)), in mm, without any floating point. That's
+// the same as the difference between the heights of the two pressures above the standard pressure,
+// scaled by (standard pressure / base pressure)^(1/5.25), and the heights come from a table. The error
+// is within 0.1m for pressures within 15000 Pa of the base pressure, and 0.35m over the sensor's whole
+// range (tools/altitudetable.py --sweep checks this.)
+int32_t BMP085::convertToAltitudeMM(uint32_t pressure)
+{
+  int32_t height = lookupHeight(pressure) - _baseHeight;
+  // height * _altitudeScale would overflow, so it's multiplied in two parts
+  int32_t high = (height >> 8) * _altitudeScale;
+  int32_t low = (int32_t)((height & 0xff) * _altitudeScale);
+  return (high + (low >> 8)) >> 7;
+}
+
+// the pressure at the given height in metres above the base pressure. This is the other way round to
+// convertToAltitude(), and is for working out thresholds, so it's not in any hurry.
+uint32_t BMP085::convertToPressure(float altitude)
+{
+  return (uint32_t)(_basePressure * pow(1.0 - altitude / 44330.0, 5.25) + 0.5);
+}
+
+// the height of the pressure above the standard pressure, in mm, interpolated from the table.
+// Pressures outside the table are taken to be at its ends.
+int32_t BMP085::lookupHeight(uint32_t pressure)
+{
+  if (pressure < ALTITUDE_TABLE_MIN_PRESSURE) pressure = ALTITUDE_TABLE_MIN_PRESSURE;
+  if (pressure > ALTITUDE_TABLE_MAX_PRESSURE) pressure = ALTITUDE_TABLE_MAX_PRESSURE;
+  uint32_t offset = pressure - ALTITUDE_TABLE_MIN_PRESSURE;
+  uint16_t i = offset >> ALTITUDE_TABLE_SHIFT;
+  int32_t fraction = offset & ((1 << ALTITUDE_TABLE_SHIFT) - 1);
+  int32_t h0 = (int32_t)pgm_read_dword(&_altitudeTable[i]);
+  if (fraction == 0) return h0;
+  int32_t h1 = (int32_t)pgm_read_dword(&_altitudeTable[i + 1]);
+  return h0 + (((h1 - h0) * fraction) >> ALTITUDE_TABLE_SHIFT);
 }
 
-uint8_t BMP085::read8bit(uint8_t reg)
+// reads length bytes starting at the given register. The sensor moves on to the next register by
+// itself, so this is one transaction however many bytes there are (up to the size of the Wire
+// library's buffer.)
+void BMP085::readBytes(uint8_t reg, uint8_t* buffer, uint8_t length)
 {
   Wire.beginTransmission(BMP085_ADDRESS);
   Wire.send(reg);
   Wire.endTransmission();
 
-  Wire.requestFrom(BMP085_ADDRESS, 1);
-  while (Wire.available() < 1) {
+  Wire.requestFrom(BMP085_ADDRESS, (int)length);
+  while (Wire.available() < length) {
   }
-  return (uint8_t)Wire.receive();
+  for (uint8_t i = 0; i < length; i++) buffer[i] = (uint8_t)Wire.receive();
 }
 
 // reads a byte from the given register and one from the following register, and returns them
 // as a 16-bit unsigned value.
 uint16_t BMP085::read16bit(uint8_t reg)
 {
-  uint16_t msb = read8bit(reg);
-  uint8_t lsb = read8bit(reg + 1);
-  return (msb << 8) + lsb;
+  uint8_t b[2];
+  readBytes(reg, b, 2);
+  return ((uint16_t)b[0] << 8) + b[1];
 }
 
 // reads bytes from the given register and the following two registers, and returns them
 // as a 32-bit unsigned value.
 uint32_t BMP085::read24bit(uint8_t reg)
 {
-  uint32_t msb = read8bit(reg);
-  uint16_t lsb = read8bit(reg + 1);
-  uint8_t patheticByte = read8bit(reg + 2);
-  return (msb << 16) + (lsb << 8) + patheticByte;
+  uint8_t b[3];
+  readBytes(reg, b, 3);
+  return ((uint32_t)b[0] << 16) + ((uint16_t)b[1] << 8) + b[2];
 }
 
 void BMP085::write8bit(uint8_t reg, uint8_t value)
@@ -236,13 +381,25 @@ void BMP085::write8bit(uint8_t reg, uint8_t value)
 
 void BMP085::test()
 {
-  Serial.println("Testing pressure sensor ...");
-  Serial.print("P: ");
+  printMessage(PRESSURE_SENSOR_TEST_MESSAGE);
+  printMessage(PRESSURE_LABEL_MESSAGE);
   softOversample(ALTIMETER_OST, ALTIMETER_OSP);
-  Serial.print(pressure);
-  Serial.print(" T: ");
-  Serial.println(temperature);
-  Serial.println("Done.");
+  SerialOut.print(pressure);
+  printMessage(TEMPERATURE_LABEL_MESSAGE);
+  SerialOut.println(temperature);
+  // how many cycles an altitude conversion takes, against the floating-point formula it replaced
+  volatile float height;
+  uint32_t startTime = micros();
+  for (int i = 0; i < 100; i++) height = convertToAltitude(pressure - i * 10, 1.0);
+  uint32_t tableTime = micros() - startTime;
+  startTime = micros();
+  for (int i = 0; i < 100; i++) height = 44330.0 * (1.0 - pow((double)(pressure - i * 10) / (double)_basePressure, 1.0 / 5.25));
+  uint32_t powTime = micros() - startTime;
+  printMessage(ALTITUDE_CONVERSION_CYCLES_MESSAGE);
+  SerialOut.print(tableTime * (F_CPU / 1000000) / 100);
+  printMessage(POW_CYCLES_MESSAGE);
+  SerialOut.println(powTime * (F_CPU / 1000000) / 100);
+  printMessage(PRESSURE_SENSOR_TEST_DONE_MESSAGE);
   
   // to pass the test the temperature should be between 15 and 30 degrees C, and the pressure between 99000 and 103000 hPa
   if (temperature < 300 && temperature > 150 && pressure < 105000 && pressure > 99000) printMessage(TEST_PASS_MESSAGE);
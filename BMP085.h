@@ -22,14 +22,27 @@
 
 #include "WProgram.h"
 #include "config.h"
+#include "ClimbFilter.h"
 
 #define BMP085_ADDRESS 0x77
+// the calibration constants are in 22 consecutive registers, starting here
+#define BMP085_CALIBRATION_REGISTER 0xAA
+#define BMP085_CALIBRATION_LENGTH 22
 
 #define BMP085_ULTRA_LOW_POWER 0
 #define BMP085_STANDARD 1
 #define BMP085_HIGH_RESOLUTION 2
 #define BMP085_ULTRA_HIGH_RESOLUTION 3
 
+// what the background oversampling is doing
+#define BMP085_IDLE 0
+#define BMP085_SAMPLING_TEMPERATURE 1
+#define BMP085_SAMPLING_PRESSURE 2
+// the conversion times from the data sheet, rounded up. They're used when there's no EOC pin, and
+// as a backstop in case the EOC interrupt is missed.
+#define BMP085_TEMPERATURE_CONVERSION_US 5000
+#define BMP085_PRESSURE_CONVERSION_US { 5000, 8000, 14000, 26000 }
+
 class BMP085
 {
   public:
@@ -41,13 +54,28 @@ class BMP085
     void disable();
     void update();
     void calculate();
+    void calculateTemperature();
+    void calculatePressure();
+    int32_t compensatePressure(uint32_t up);
     void updateRawTemperature();
     void updateRawPressure();
     void softOversample(int ost, int osp);
+    // these do the same as softOversample(), but in the background. service() should be called
+    // each time around the main loop, and returns true when the new temperature and pressure are ready.
+    void startOversample(uint8_t ost, uint8_t osp);
+    boolean service();
+    boolean isSampling();
+    // the oversampling only measures the temperature if it's been this long since it was last
+    // measured. Zero, which is what it starts at, means every time.
+    void setTemperatureInterval(uint32_t intervalMS);
+    // every pressure conversion made while oversampling is passed to the climb filter, if there is one
+    void setClimbFilter(ClimbFilter* climbFilter);
     void setBasePressure();
     void setBasePressure(int32_t pressure);
     uint32_t getBasePressure();
     float convertToAltitude(uint32_t pressure, float heightUnits);
+    int32_t convertToAltitudeMM(uint32_t pressure);
+    uint32_t convertToPressure(float altitude);
     void test();
   private:
     // configuration
@@ -67,14 +95,40 @@ class BMP085
     int16_t _mc;
     int16_t _md;
     uint32_t _basePressure;
+    // what the altitude conversion needs to know about the base pressure: its height above the
+    // standard pressure in mm, and (standard pressure / base pressure)^(1/5.25) scaled by 2^15
+    int32_t _baseHeight;
+    uint16_t _altitudeScale;
     // raw readings
     uint32_t _ut;
     uint32_t _up;
+    // the parts of the pressure calculation that only depend on the temperature
+    int32_t _b3;
+    uint32_t _b4;
+    uint32_t _temperatureInterval;
+    uint32_t _temperatureTime;
+    boolean _haveTemperature;
+    ClimbFilter* _climbFilter;
+    // the background oversampling: the conversions still to do of the current kind, the number of
+    // pressure conversions, and the sum of the readings so far
+    uint8_t _state;
+    uint8_t _ost;
+    uint8_t _osp;
+    uint8_t _conversionsLeft;
+    uint32_t _sum;
+    // when the conversion that's going on was started, and how long it should take
+    uint32_t _conversionStartTime;
+    uint16_t _conversionTime;
+    void startTemperatureConversion();
+    void startPressureConversion();
+    void startConversion(uint8_t command, uint16_t conversionTime);
+    boolean isConversionDone();
     // low-level comms with the device
-    uint8_t read8bit(uint8_t register);
+    void readBytes(uint8_t register, uint8_t* buffer, uint8_t length);
     uint16_t read16bit(uint8_t register);
     uint32_t read24bit(uint8_t register);
     void write8bit(uint8_t register, uint8_t value);
+    static int32_t lookupHeight(uint32_t pressure);
 };
 
 #endif /*BMP085_H*/
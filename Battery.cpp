@@ -22,6 +22,7 @@
 #include "WProgram.h"
 
 #include "Messages.h"
+#include "SerialOutput.h"
 #include "Settings.h"
 #include <math.h>
 
@@ -86,7 +87,7 @@ void Battery::test()
   printMessage(BATTERY_TEST_MESSAGE);
   printMessage(BATTERY_MESSAGE);
   float v = readVoltage();
-  Serial.println(v);
+  SerialOut.println(v);
   // the voltage must be between 4.8 and 5.1 to pass the test
   if (v < 5.08 && v > 4.92) printMessage(TEST_PASS_MESSAGE);
   else printMessage(TEST_FAIL_MESSAGE);
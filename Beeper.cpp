@@ -22,6 +22,7 @@
 #include "WProgram.h"
 
 #include "Messages.h"
+#include "SerialOutput.h"
 
 #include <util/delay.h>
 
@@ -116,8 +117,8 @@ void Beeper::waitForTuneToEnd()
 
 void Beeper::outputInteger(int integer)
 {
-  Serial.print("Outputting ");
-  Serial.println(integer);
+  printMessage(OUTPUTTING_MESSAGE);
+  SerialOut.println(integer);
   // 8 digits maximum
   char intString[8];
   sprintf(intString, "%i", integer);
@@ -0,0 +1,109 @@
+/*
+    openaltimeter -- an open-source altimeter for RC aircraft
+    Copyright (C) 2010  Jony Hudson
+    http://openaltimeter.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "ClimbFilter.h"
+#include "WProgram.h"
+
+// the filter's state is kept in sixteenths of a Pa, which leaves room for the largest residual
+// times a gain of one in 32 bits
+#define CLIMB_FILTER_SCALE 16
+#define CLIMB_FILTER_MAX_RESIDUAL 32767
+
+ClimbFilter::ClimbFilter()
+{
+  reset();
+}
+
+void ClimbFilter::reset()
+{
+  _pressure = 0;
+  _rate = 0;
+  _time = 0;
+  _started = false;
+  _newEstimate = false;
+}
+
+void ClimbFilter::add(int32_t pressure, uint32_t time)
+{
+  update(pressure, time, CLIMB_FILTER_MAX_GAP_MS);
+}
+
+void ClimbFilter::addReplayed(int32_t pressure, uint32_t time)
+{
+  update(pressure, time, 0xffffffff);
+}
+
+// a gap of more than maxGap starts the filter again.
+void ClimbFilter::update(int32_t pressure, uint32_t time, uint32_t maxGap)
+{
+  _newEstimate = true;
+  uint32_t dt = time - _time;
+  if (!_started || dt > maxGap || dt == 0)
+  {
+    _pressure = pressure * CLIMB_FILTER_SCALE;
+    _rate = 0;
+    _time = time;
+    _started = true;
+    return;
+  }
+  _time = time;
+  // predict where the pressure should be now ...
+  int32_t change = (_rate * (int32_t)dt) / 1000;
+  _pressure += change;
+  // ... and move the estimate towards the reading by an amount that grows with the gap
+  int32_t residual = pressure * CLIMB_FILTER_SCALE - _pressure;
+  if (residual > CLIMB_FILTER_MAX_RESIDUAL) residual = CLIMB_FILTER_MAX_RESIDUAL;
+  if (residual < -CLIMB_FILTER_MAX_RESIDUAL) residual = -CLIMB_FILTER_MAX_RESIDUAL;
+  if (dt >= CLIMB_FILTER_MAX_STEP_MS)
+  {
+    // both gains have reached one, so the estimate is the reading, and the rate is the change
+    // since the last estimate
+    _pressure += residual;
+    _rate += (residual * 1000) / (int32_t)dt;
+    return;
+  }
+  uint32_t alpha = CLIMB_FILTER_ALPHA * dt;
+  if (alpha > 65536) alpha = 65536;
+  _pressure += (residual * (int32_t)alpha) >> 16;
+  // beta / dt is omega^2 * dt, so there's no division here
+  _rate += (((residual * (int32_t)dt) >> 4) * CLIMB_FILTER_OMEGA2) >> 12;
+}
+
+boolean ClimbFilter::hasNewEstimate()
+{
+  boolean newEstimate = _newEstimate;
+  _newEstimate = false;
+  return newEstimate;
+}
+
+int32_t ClimbFilter::getPressure()
+{
+  return _pressure / CLIMB_FILTER_SCALE;
+}
+
+int32_t ClimbFilter::getClimbRate()
+{
+  return -_rate / CLIMB_FILTER_SCALE;
+}
+
+uint32_t ClimbFilter::getTime()
+{
+  return _time;
+}
@@ -0,0 +1,60 @@
+/*
+    openaltimeter -- an open-source altimeter for RC aircraft
+    Copyright (C) 2010  Jony Hudson
+    http://openaltimeter.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CLIMBFILTER_H
+#define CLIMBFILTER_H
+
+#include "WProgram.h"
+#include "config.h"
+
+// The climb filter tracks the pressure and the rate at which it's changing from every pressure
+// conversion, which is much more often than the log is written. It's an alpha-beta filter, which
+// is what a Kalman filter for a steady climb settles down to, in fixed point. The gains are worked
+// out from the time since the last reading, so it behaves the same whether it's fed a conversion
+// every few ms or a replayed log entry every half second: for gaps longer than the filter's time
+// constant it just follows the readings. A gap longer than CLIMB_FILTER_MAX_GAP_MS starts it again.
+class ClimbFilter
+{
+  public:
+    ClimbFilter();
+    void reset();
+    // adds a pressure reading, in Pa, taken at the given time in ms
+    void add(int32_t pressure, uint32_t time);
+    // the same for a reading from a replayed log, whose entries can be further apart than
+    // CLIMB_FILTER_MAX_GAP_MS without there being a break in the data
+    void addReplayed(int32_t pressure, uint32_t time);
+    // true once for each reading that's been added, so that the height monitor can run on it
+    boolean hasNewEstimate();
+    // the filtered pressure, in Pa
+    int32_t getPressure();
+    // the rate at which the pressure is falling, in Pa/s, so it's positive when climbing
+    int32_t getClimbRate();
+    // the time of the latest reading, in ms
+    uint32_t getTime();
+  private:
+    // these are scaled by CLIMB_FILTER_SCALE
+    int32_t _pressure;
+    int32_t _rate;
+    uint32_t _time;
+    boolean _started;
+    boolean _newEstimate;
+    void update(int32_t pressure, uint32_t time, uint32_t maxGap);
+};
+
+#endif /*CLIMBFILTER_H*/
@@ -24,137 +24,1427 @@
 #include "WProgram.h"
 
 #include "Messages.h"
+#include "SerialOutput.h"
+
+#include <avr/pgmspace.h>
+
+// the scaling of each channel, as written in the file header: value = offset + (raw * scale), in
+// the units that LogEntry uses.
+float _datastoreChannelScaling[DATASTORE_NUMBER_OF_CHANNELS][2] PROGMEM =
+{
+  {101325.0, 1.0},
+  {-150.0, 2.5},
+  {2.0, 0.05},
+  {500.0, 8.0}
+};
 
 
 Datastore::Datastore(AT25DF* flash)
 {
   _flash = flash;
   _firstFreeAddress = 0;
+  _firstFile = 0;
   _numberOfFiles = 0;
-  _readPointer = 0;
+  _numberOfEntries = 0;
+  _fileEntries = 0;
+  _recordsSinceKeyframe = 0;
+  _channels = DATASTORE_ALL_CHANNELS;
+  _fileChannels = 0;
+  _interval = LOG_INTERVAL_MS_DEFAULT;
+  _fileInterval = 0;
+  _journalSlot = 0;
+  _lastCheckpoint = 0;
+  memset(&_recordEnd, 0, sizeof(_recordEnd));
+  memset(&_pendingCheckpoint, 0, sizeof(_pendingCheckpoint));
+  _fileOpen = false;
+  _tail = 0;
+  memset(&_tailSector, 0, sizeof(_tailSector));
+#ifdef DATASTORE_RING_MODE
+  _erasedTo = 0;
+  _tailMoved = false;
+#endif
+  _oldData = false;
+  _dataReadAddress = 0;
+  _readCursor = NULL;
+  _bufferAddress = 0;
+  _bufferFill = 0;
+  _queueHead = 0;
+  _queueDepth = 0;
+  _nextPollTime = 0;
+  _writeStalls = 0;
 }
 
+// this mounts the datastore, finding the first free address and the files. If the flash is not
+// blank then this function must be called before anything else is done. Most of the work is done
+// by the directory and journal, so the time this takes doesn't depend on how much has been logged.
 void Datastore::setup()
 {
-  scanFlash();
+  // the mount reads the flash directly, so any cursor's read has to be started again
+  _readCursor = NULL;
+  _fileOpen = false;
+  _fileEntries = 0;
+  _pendingCheckpoint.head = 0;
+  _oldData = false;
+  _tail = 0;
+  memset(&_tailSector, 0, sizeof(_tailSector));
+  mountDirectory();
+  JournalRecord checkpoint;
+  readLastCheckpoint(&checkpoint);
+  _lastCheckpoint = checkpoint.head;
+  _recordEnd = checkpoint;
+  _numberOfEntries = checkpoint.totalEntries;
+  if (_numberOfFiles == 0)
+  {
+    // either the flash is blank, or it was written by firmware that used the old V1 format, which
+    // can't be read as V3. In that case we mark the flash as full, so that nothing gets written
+    // after the old data, which can still be downloaded, until it's erased.
+    if (isPageErased(0)) _firstFreeAddress = 0;
+    else
+    {
+      printMessage(OLD_DATA_FORMAT_MESSAGE);
+      _firstFreeAddress = DATASTORE_DATA_SIZE;
+      _oldData = true;
+    }
+#ifdef DATASTORE_RING_MODE
+    _erasedTo = _firstFreeAddress;
+#endif
+    return;
+  }
+  // we start looking for the free space from the furthest point that we know has been written
+  uint32_t head = checkpoint.head;
+  FileRecord record;
+  readFileRecord(_numberOfFiles - 1, &record);
+  boolean lastFileEnded = isEndValid(&record);
+  if (lastFileEnded && (record.endAddress + 1 > head)) head = record.endAddress + 1;
+  JournalRecord* start = &checkpoint;
+  uint32_t dataEnd;
+#ifdef DATASTORE_RING_MODE
+  // in ring mode the free space is found from the sector records instead, as the flash isn't just
+  // used up to a point. The newest sector record is a checkpoint too, and might be more recent than
+  // the journal's.
+  JournalRecord newest;
+  if (findSectors(&newest))
+  {
+    if (newest.head > start->head) start = &newest;
+    dataEnd = findEndOfSector(newest.head);
+  }
+  else dataEnd = findEndOfData(head, DATASTORE_DATA_SIZE);
+#else
+  dataEnd = findEndOfData(head, DATASTORE_DATA_SIZE);
+#endif
+  // the records after the checkpoint are read through, to count their entries, and to find the end
+  // of the last whole record. If the power went off between programming two pages then there might
+  // be part of a record after that, which is padded out.
+  _numberOfEntries = start->totalEntries;
+  _fileEntries = start->fileEntries;
+  uint32_t recordsEnd = scanRecords(start->head, dataEnd);
+  if (recordsEnd < dataEnd) writePadding(recordsEnd, dataEnd);
+  // the data is followed by a file end marker, and then the free space. The free space search can't
+  // see end markers after the last data, as they are never written, but the directory or journal
+  // will know about them.
+  _firstFreeAddress = (dataEnd == 0) ? 0 : dataEnd + 1;
+  if (_firstFreeAddress < head) _firstFreeAddress = head;
+#ifdef DATASTORE_RING_MODE
+  // the rest of the sector that the data ends in is erased. If the data filled it exactly then the end
+  // marker can't be the first byte of the next sector, which has to start with a sector record. That
+  // has to be in the flash before the directory can say that a file ends after it.
+  _erasedTo = ((dataEnd + DATASTORE_SECTOR_SIZE - 1) / DATASTORE_SECTOR_SIZE) * DATASTORE_SECTOR_SIZE;
+  if (dataEnd > 0 && _firstFreeAddress == dataEnd + 1 && (dataEnd % DATASTORE_SECTOR_SIZE) == 0)
+  {
+    _firstFreeAddress = dataEnd;
+    reserveSpace(1);
+    flush();
+    _firstFreeAddress++;
+  }
+#endif
+  if (!lastFileEnded)
+  {
+    // the last file wasn't ended properly, most likely because the logger was switched off. The
+    // byte after its data is treated as the end marker, so record that.
+    uint32_t start = getFileStartAddress(_numberOfFiles - 1);
+    if (_firstFreeAddress > start) endFile(_numberOfFiles - 1, _firstFreeAddress - 1, _fileEntries);
+    else
+    {
+      // none of the file's data made it to the flash, so we just carry on writing it
+      _firstFreeAddress = start;
+      _fileOpen = true;
+    }
+  }
+  _fileEntries = 0;
+  _recordEnd.head = _firstFreeAddress;
+  _recordEnd.fileEntries = 0;
+  _recordEnd.totalEntries = _numberOfEntries;
+  dropExpiredFiles();
 }
 
+// only the part of the flash that's been used is erased, along with the metadata, which is much quicker
+// than erasing the whole chip when there isn't much in the log. Old format data, or a ring that has
+// wrapped around, could be anywhere, so then the whole chip is erased.
 void Datastore::erase()
 {
-  _flash->chipErase();
+  uint32_t erasedTo = DATASTORE_DATA_SIZE;
+  if (_oldData || _firstFreeAddress >= DATASTORE_DATA_SIZE) _flash->chipErase();
+  else
+  {
+    erasedTo = ((_firstFreeAddress + DATASTORE_SECTOR_SIZE - 1) / DATASTORE_SECTOR_SIZE) * DATASTORE_SECTOR_SIZE;
+    _flash->eraseRange(0, erasedTo);
+    for (uint32_t address = DATASTORE_DIRECTORY_ADDRESS; address < AT25DF_SIZE; address += DATASTORE_SECTOR_SIZE) eraseMetadataSector(address);
+  }
+  // anything in the page buffers is meant for the old contents of the flash, so throw it away
+  _bufferFill = 0;
+  _queueDepth = 0;
   _firstFreeAddress = 0;
+  _firstFile = 0;
   _numberOfFiles = 0;
+  _numberOfEntries = 0;
+  _fileEntries = 0;
+  _journalSlot = 0;
+  _lastCheckpoint = 0;
+  memset(&_recordEnd, 0, sizeof(_recordEnd));
+  _pendingCheckpoint.head = 0;
+  _fileOpen = false;
+  _tail = 0;
+  memset(&_tailSector, 0, sizeof(_tailSector));
+#ifdef DATASTORE_RING_MODE
+  _erasedTo = erasedTo;
+  _tailMoved = false;
+#endif
+  _oldData = false;
+}
+
+// in ring mode the log is never full, but either way it mustn't be written to if it holds old format
+// data that hasn't been erased yet.
+boolean Datastore::isFull()
+{
+  if (_oldData) return true;
+#ifdef DATASTORE_RING_MODE
+  return false;
+#else
+  return (_firstFreeAddress > DATASTORE_MAX_ADDRESS);
+#endif
 }
 
+// entries don't go straight to the flash, they are collected in a page buffer, which is queued
+// to be written whenever it reaches the end of a flash page. This means that the flash only has to
+// be programmed once per page rather than once per byte. The flip side is that the most recent
+// entries are only in RAM, so reads of the log take them from the page buffers, and flush() must be
+// called when logging stops.
 boolean Datastore::addEntry(LogEntry* logEntry)
 {
-  if (_firstFreeAddress < DATASTORE_MAX_ADDRESS) {
-    _flash->writeArray(_firstFreeAddress, (byte*)logEntry, DATASTORE_LOG_ENTRY_SIZE);
-    _firstFreeAddress += DATASTORE_LOG_ENTRY_SIZE;   
+  if (!isFull()) {
+    // the first entry of a file gets it a directory record. If the directory is full then so are we.
+    if (!_fileOpen && !startFile(_firstFreeAddress)) return false;
+    uint8_t record[DATASTORE_MAX_RECORD_SIZE];
+    uint8_t length;
+    // every file starts with a header, and there's a new one if the channels change. Either way,
+    // the next entry has to be a keyframe.
+    if (_fileEntries == 0 || _channels != _fileChannels)
+    {
+      _fileChannels = _channels;
+      length = encodeHeader(_fileChannels, record);
+      reserveSpace(length);
+      appendRecord(record, length);
+      _recordsSinceKeyframe = DATASTORE_KEYFRAME_INTERVAL;
+    }
+    // the rate follows the header at the start of a file, and is written again when it changes
+    if (_fileEntries == 0 || _interval != _fileInterval)
+    {
+      _fileInterval = _interval;
+      length = encodeRate(_fileInterval, record);
+      reserveSpace(length);
+      appendRecord(record, length);
+    }
+    // this has to be done before the entry is encoded, as a new sector starts with a keyframe
+    reserveSpace(DATASTORE_MAX_SAMPLE_SIZE);
+    length = encodeEntry(logEntry, record);
+    _numberOfEntries++;
+    _fileEntries++;
+    appendRecord(record, length);
     return true;
   }
   else return false;
 }
 
-void Datastore::addFileEndMarker()
+// events are logged between the entries, at the point that they happen. They can only be added
+// to a file that has some entries in it.
+boolean Datastore::addEvent(uint8_t event)
 {
-  // We'll use a sequence of bytes, the length of a LogEntry, all set to 0xff
-  // as a file end marker. As the flash erases all bytes to 0xff we need do
-  // no writing, just move the _firstFreeAddress pointer.
-  _firstFreeAddress += DATASTORE_LOG_ENTRY_SIZE; 
-  _numberOfFiles++;
+  if (!_fileOpen || _fileEntries == 0 || isFull()) return false;
+  uint8_t record[DATASTORE_EXTENDED_OVERHEAD + 1];
+  record[2] = event;
+  reserveSpace(sizeof(record));
+  appendRecord(record, frameExtendedRecord(DATASTORE_TAG_EVENT, record, 3));
+  return true;
+}
+
+// sets which channels are logged. The pressure is always logged, whatever is asked for. If a file
+// is being written then the change takes effect from its next entry.
+void Datastore::setChannels(uint8_t channels)
+{
+  _channels = (channels & DATASTORE_ALL_CHANNELS) | DATASTORE_CHANNEL_PRESSURE;
+}
+
+// sets the time between entries that's recorded in the log, which is the time from the entry before
+// to the next entry that's added. It can be negative, see the description of the rate record.
+void Datastore::setInterval(int16_t intervalMS)
+{
+  _interval = intervalMS;
 }
 
-void Datastore::startRead()
+void Datastore::appendRecord(uint8_t* record, uint8_t length)
 {
-  _readPointer = 0;
+  for (int i = 0; i < length; i++)
+  {
+    if (_bufferFill == 0) _bufferAddress = _firstFreeAddress;
+    _pageBuffers[fillBufferIndex()][_bufferFill++] = record[i];
+    _firstFreeAddress++;
+    // records don't divide evenly into pages, so a record can be split between two pages
+    if ((_firstFreeAddress % AT25DF_PAGE_SIZE) == 0) queueFillBuffer();
+  }
+  // this is where a checkpoint can be taken from, as it's the end of a whole record
+  _recordEnd.head = _firstFreeAddress;
+  _recordEnd.fileEntries = _fileEntries;
+  _recordEnd.totalEntries = _numberOfEntries;
 }
 
-void Datastore::getNextEntry(LogEntry* buffer)
+// in ring mode, records aren't allowed to cross sector boundaries, and every sector has to start with
+// a sector record. This makes room for a record of the given length in the sector that's being written,
+// padding out the rest of it if the record won't fit, and starting a new sector if needed.
+void Datastore::reserveSpace(uint8_t length)
 {
-  _flash->readArray(_readPointer, (byte*)buffer, DATASTORE_LOG_ENTRY_SIZE );
-  _readPointer += DATASTORE_LOG_ENTRY_SIZE; 
+#ifdef DATASTORE_RING_MODE
+  uint16_t sectorRemaining = DATASTORE_SECTOR_SIZE - (_firstFreeAddress % DATASTORE_SECTOR_SIZE);
+  if (sectorRemaining < DATASTORE_SECTOR_SIZE && length > sectorRemaining)
+  {
+    uint8_t padding[DATASTORE_MAX_RECORD_SIZE];
+    memset(padding, DATASTORE_TAG_PAD, sectorRemaining);
+    appendRecord(padding, sectorRemaining);
+  }
+  if ((_firstFreeAddress % DATASTORE_SECTOR_SIZE) == 0) startSector();
+#endif
 }
 
-boolean Datastore::entryAvailable()
+// a sector starts with a sector record, which says where it is in the log. If it's part way through a
+// file then it has the file's header too, and the next entry is a keyframe, so that the file can be
+// read from here once the sectors before have been overwritten.
+void Datastore::startSector()
 {
-  return !(_readPointer == _firstFreeAddress);
+  uint8_t record[DATASTORE_MAX_RECORD_SIZE];
+  JournalRecord contents;
+  contents.head = _firstFreeAddress;
+  contents.fileEntries = _fileEntries;
+  contents.totalEntries = _numberOfEntries;
+  memcpy(record + 2, &contents, DATASTORE_SECTOR_RECORD_CONTENTS_SIZE);
+  appendRecord(record, frameExtendedRecord(DATASTORE_TAG_SECTOR, record, 2 + DATASTORE_SECTOR_RECORD_CONTENTS_SIZE));
+  if (_fileOpen && _fileEntries > 0)
+  {
+    appendRecord(record, encodeHeader(_fileChannels, record));
+    appendRecord(record, encodeRate(_fileInterval, record));
+  }
+  _recordsSinceKeyframe = DATASTORE_KEYFRAME_INTERVAL;
 }
 
-void Datastore::startReverseRead()
+// encodes the entry as a sample record, using as few bytes as it can, and returns the length. The
+// entry is encoded against the previous one in the file, unless it's time for a keyframe. Only
+// the channels that are in the file's header are stored.
+uint8_t Datastore::encodeEntry(LogEntry* logEntry, uint8_t* record)
 {
-  _readPointer = _firstFreeAddress - DATASTORE_LOG_ENTRY_SIZE;
+  int32_t delta = (int32_t)logEntry->pressureRaw - (int32_t)_lastEntry.pressureRaw;
+  if (_recordsSinceKeyframe >= DATASTORE_KEYFRAME_INTERVAL)
+  {
+    _lastEntry = *logEntry;
+    _recordsSinceKeyframe = 0;
+    return encodeKeyframe(logEntry, _fileChannels, record);
+  }
+  uint8_t fields = 0;
+  if (logEntry->temperatureRaw != _lastEntry.temperatureRaw) fields |= DATASTORE_FIELD_TEMPERATURE;
+  if (logEntry->batteryRaw != _lastEntry.batteryRaw) fields |= DATASTORE_FIELD_BATTERY;
+  if (logEntry->servoRaw != _lastEntry.servoRaw) fields |= DATASTORE_FIELD_SERVO;
+  fields &= _fileChannels;
+  if (delta < -128 || delta > 127) fields |= DATASTORE_FIELD_ABSOLUTE_PRESSURE;
+  _lastEntry = *logEntry;
+  _recordsSinceKeyframe++;
+  // the common case: only the pressure has changed, and not by much
+  if (fields == 0 && delta >= 1 - DATASTORE_DELTA_OFFSET && delta <= 127 - DATASTORE_DELTA_OFFSET)
+  {
+    record[0] = delta + DATASTORE_DELTA_OFFSET;
+    return 1;
+  }
+  return encodeSample(logEntry, fields, delta, record);
 }
 
-void Datastore::getPreviousEntry(LogEntry* buffer)
+// a keyframe has every field that's in the file, so it can be decoded without the records before it.
+uint8_t Datastore::encodeKeyframe(LogEntry* logEntry, uint8_t channels, uint8_t* record)
 {
-  _flash->readArray(_readPointer, (byte*)buffer, DATASTORE_LOG_ENTRY_SIZE );
-  _readPointer -= DATASTORE_LOG_ENTRY_SIZE; 
+  uint8_t fields = DATASTORE_FIELD_KEYFRAME | DATASTORE_FIELD_ABSOLUTE_PRESSURE | (channels & ~DATASTORE_CHANNEL_PRESSURE);
+  return encodeSample(logEntry, fields, 0, record);
 }
 
-boolean Datastore::entryReverseAvailable()
+// writes out a sample record with the given fields. The delta is only used if the pressure isn't absolute.
+uint8_t Datastore::encodeSample(LogEntry* logEntry, uint8_t fields, int32_t delta, uint8_t* record)
 {
-  return !(_readPointer == 0);
+  uint8_t tag = DATASTORE_TAG_SAMPLE | fields;
+  uint8_t length = 0;
+  record[length++] = tag;
+  if (fields & DATASTORE_FIELD_ABSOLUTE_PRESSURE)
+  {
+    record[length++] = lowByte(logEntry->pressureRaw);
+    record[length++] = highByte(logEntry->pressureRaw);
+  }
+  else record[length++] = (int8_t)delta;
+  if (fields & DATASTORE_FIELD_TEMPERATURE) record[length++] = logEntry->temperatureRaw;
+  if (fields & DATASTORE_FIELD_BATTERY) record[length++] = logEntry->batteryRaw;
+  if (fields & DATASTORE_FIELD_SERVO) record[length++] = logEntry->servoRaw;
+  record[length++] = tag;
+  return length;
 }
 
-// this function finds the first free address and counts the number of files. If
-// the flash is not blank then this function must be called before anything else
-// is done.
-// A file is considered to end when a "blank" entry is found, i.e. filled all with
-// 0xff. When we find two consecutive blank entries we know that we've found the
-// start of the free space.
-void Datastore::scanFlash()
+uint8_t Datastore::encodeHeader(uint8_t channels, uint8_t* record)
 {
-  byte entryBytes[DATASTORE_LOG_ENTRY_SIZE];
-  uint32_t entryChecksum;
-  boolean previousEntryBlank = false;
-  _numberOfFiles = 0;
-  startRead();
-  while (_readPointer < DATASTORE_MAX_ADDRESS)
-  {
-    getNextEntry((LogEntry*)entryBytes);
-    // we add the bytes of the LogEntry together. The only way we can get 0xff * DATASTORE_LOG_ENTRY_SIZE
-    // is if all the bytes are 0xff i.e. this is a blank entry.
-    entryChecksum = 0;
-    for (int i = 0; i < DATASTORE_LOG_ENTRY_SIZE; i++) entryChecksum += entryBytes[i];
-//    ((LogEntry*)entryBytes)->print();
-//    Serial.println(entryChecksum);
-    if (entryChecksum == ((uint32_t)0xff * (uint32_t)DATASTORE_LOG_ENTRY_SIZE))
+  uint8_t length = 2;
+  record[length++] = DATASTORE_FORMAT_VERSION;
+  record[length++] = channels;
+  for (uint8_t channel = 0; channel < DATASTORE_NUMBER_OF_CHANNELS; channel++)
+  {
+    if (!(channels & (1 << channel))) continue;
+    memcpy_P(record + length, _datastoreChannelScaling[channel], DATASTORE_CHANNEL_SCALING_SIZE);
+    length += DATASTORE_CHANNEL_SCALING_SIZE;
+  }
+  return frameExtendedRecord(DATASTORE_TAG_HEADER, record, length);
+}
+
+uint8_t Datastore::encodeRate(int16_t interval, uint8_t* record)
+{
+  record[2] = lowByte(interval);
+  record[3] = highByte(interval);
+  return frameExtendedRecord(DATASTORE_TAG_RATE, record, 4);
+}
+
+// puts the tags and lengths around the contents of an extended record, which start at record[2]
+// and end just before contentsEnd. Returns the length of the record.
+uint8_t Datastore::frameExtendedRecord(uint8_t tag, uint8_t* record, uint8_t contentsEnd)
+{
+  uint8_t length = contentsEnd + 2;
+  record[0] = tag;
+  record[1] = length;
+  record[length - 2] = length;
+  record[length - 1] = tag;
+  return length;
+}
+
+// applies a record to the entry, which should hold the entry before it in the log. A file end
+// marker turns the entry into a file end marker, and a header clears it, so that any channels
+// that aren't in the file read as zero.
+void Datastore::decodeRecord(uint8_t* record, LogEntry* logEntry)
+{
+  uint8_t tag = record[0];
+  if (tag == DATASTORE_TAG_PAD) return;
+  if (tag < DATASTORE_TAG_SAMPLE)
+  {
+    logEntry->pressureRaw += (int16_t)tag - DATASTORE_DELTA_OFFSET;
+    return;
+  }
+  if (tag == DATASTORE_TAG_FILE_END)
+  {
+    memset(logEntry, 0xff, sizeof(LogEntry));
+    return;
+  }
+  if (tag == DATASTORE_TAG_HEADER)
+  {
+    memset(logEntry, 0, sizeof(LogEntry));
+    return;
+  }
+  if ((tag & DATASTORE_TAG_MASK) != DATASTORE_TAG_SAMPLE) return;
+  uint8_t i = 1;
+  if (tag & DATASTORE_FIELD_ABSOLUTE_PRESSURE)
+  {
+    logEntry->pressureRaw = (int16_t)(record[1] | (record[2] << 8));
+    i = 3;
+  }
+  else logEntry->pressureRaw += (int8_t)record[i++];
+  if (tag & DATASTORE_FIELD_TEMPERATURE) logEntry->temperatureRaw = record[i++];
+  if (tag & DATASTORE_FIELD_BATTERY) logEntry->batteryRaw = record[i++];
+  if (tag & DATASTORE_FIELD_SERVO) logEntry->servoRaw = record[i++];
+}
+
+// whether the record is a log entry, or a file end marker, rather than padding or an extended record.
+boolean Datastore::isEntry(uint8_t tag)
+{
+  return ((tag != DATASTORE_TAG_PAD && tag < DATASTORE_TAG_EXTENDED) || tag == DATASTORE_TAG_FILE_END);
+}
+
+boolean Datastore::isExtended(uint8_t tag)
+{
+  return ((tag & DATASTORE_TAG_MASK) == DATASTORE_TAG_EXTENDED);
+}
+
+boolean Datastore::isKeyframe(uint8_t tag)
+{
+  return ((tag & DATASTORE_TAG_MASK) == DATASTORE_TAG_SAMPLE && (tag & DATASTORE_FIELD_KEYFRAME));
+}
+
+// the length of a record can be found from either its first or its last byte, along with the
+// length byte next to it for extended records. A damaged length is kept within bounds, so
+// that it can't overrun a record buffer.
+uint8_t Datastore::recordLength(uint8_t tag, uint8_t extendedLength)
+{
+  if (isExtended(tag))
+  {
+    if (extendedLength < DATASTORE_EXTENDED_OVERHEAD) return DATASTORE_EXTENDED_OVERHEAD;
+    if (extendedLength > DATASTORE_MAX_RECORD_SIZE) return DATASTORE_MAX_RECORD_SIZE;
+    return extendedLength;
+  }
+  if ((tag & DATASTORE_TAG_MASK) != DATASTORE_TAG_SAMPLE) return 1;
+  // the two tags and a pressure delta
+  uint8_t length = 3;
+  if (tag & DATASTORE_FIELD_ABSOLUTE_PRESSURE) length++;
+  if (tag & DATASTORE_FIELD_TEMPERATURE) length++;
+  if (tag & DATASTORE_FIELD_BATTERY) length++;
+  if (tag & DATASTORE_FIELD_SERVO) length++;
+  return length;
+}
+
+// log addresses go on past the end of the data area in ring mode, and wrap around to the start.
+uint32_t Datastore::physicalAddress(uint32_t address)
+{
+  return address % DATASTORE_DATA_SIZE;
+}
+
+void Datastore::startDataRead(uint32_t address)
+{
+  _dataReadAddress = address;
+  _readCursor = NULL;
+  _flash->startSequentialRead(physicalAddress(address));
+}
+
+// reads on through the data area, going back to the start of the flash when the read gets to the
+// end of the data area, rather than on into the metadata.
+void Datastore::dataRead(uint8_t* buffer, uint16_t num)
+{
+  while (num > 0)
+  {
+    uint32_t buffered = bufferedFrom();
+    if (_dataReadAddress >= buffered)
+    {
+      readBuffered(_dataReadAddress, buffer, num);
+      _dataReadAddress += num;
+      // the buffers might be programmed before the next read, which then has to come from the flash
+      _flash->startSequentialRead(physicalAddress(_dataReadAddress));
+      return;
+    }
+    uint32_t toEnd = DATASTORE_DATA_SIZE - physicalAddress(_dataReadAddress);
+    if (buffered - _dataReadAddress < toEnd) toEnd = buffered - _dataReadAddress;
+    uint16_t chunk = (num < toEnd) ? num : toEnd;
+    _flash->sequentialRead(buffer, chunk);
+    buffer += chunk;
+    num -= chunk;
+    _dataReadAddress += chunk;
+    if (physicalAddress(_dataReadAddress) == 0) _flash->startSequentialRead(0);
+  }
+}
+
+// reads a few bytes from the data area, which might wrap around.
+void Datastore::readData(uint32_t address, uint8_t* buffer, uint8_t num)
+{
+  uint32_t physical = physicalAddress(address);
+  uint32_t buffered = bufferedFrom();
+  if (address + num <= buffered && physical + num <= DATASTORE_DATA_SIZE) _flash->readArray(physical, buffer, num);
+  else for (uint8_t i = 0; i < num; i++)
+  {
+    if (address + i >= buffered) readBuffered(address + i, buffer + i, 1);
+    else _flash->readArray(physicalAddress(address + i), buffer + i, 1);
+  }
+}
+
+// the start of the data that's only in the page buffers, which runs on to the write head. The queued
+// pages and the buffer being filled follow on from each other. If nothing is buffered then everything
+// is read from the flash, which is what the mount needs, as it reads past the write head to find it.
+uint32_t Datastore::bufferedFrom()
+{
+  if (_queueDepth > 0) return _pageAddresses[_queueHead];
+  if (_bufferFill > 0) return _bufferAddress;
+  return 0xffffffff;
+}
+
+// copies data that hasn't been programmed yet out of the page buffers. Anything past the write head
+// reads as erased, as it would from the flash.
+void Datastore::readBuffered(uint32_t address, uint8_t* buffer, uint16_t num)
+{
+  while (num > 0)
+  {
+    if (address >= _firstFreeAddress)
     {
-      // we've found a blank entry, so update the file counter
-      _numberOfFiles++;
-      // if the previous entry was also blank, then we've found the end
-      // of the used portion of the flash
-      if (previousEntryBlank)
+      memset(buffer, 0xff, num);
+      return;
+    }
+    uint8_t index = fillBufferIndex();
+    uint32_t pageAddress = _bufferAddress;
+    uint16_t pageFill = _bufferFill;
+    for (uint8_t i = 0; i < _queueDepth; i++)
+    {
+      uint8_t queued = (_queueHead + i) % DATASTORE_WRITE_QUEUE_LENGTH;
+      if (address < _pageAddresses[queued] + _pageFills[queued])
       {
-        // the readPointer is now pointing to the start of the entry after the _two_ blank entries, so
-        // take it back one entry and set this as the first free address
-        _firstFreeAddress = _readPointer - DATASTORE_LOG_ENTRY_SIZE;
-        // there's no need for a blank entry at the start of the flash - deal with this as a special case
-        if (_firstFreeAddress == DATASTORE_LOG_ENTRY_SIZE)
-        {
-          _firstFreeAddress = 0;
-          _numberOfFiles = 0;
-        }
-        else
-        {
-          // the file counter will be one bigger than it should be, because of the last blank entry, so fix it
-          _numberOfFiles -= 1;
-        }
-        return;
+        index = queued;
+        pageAddress = _pageAddresses[queued];
+        pageFill = _pageFills[queued];
+        break;
       }
-      // set a flag that this is entry is blank, in case the next one also is, signifying the end of 
-      // the used portion
-      previousEntryBlank = true;
     }
-    else
+    uint16_t offset = address - pageAddress;
+    uint16_t chunk = pageFill - offset;
+    if (chunk > num) chunk = num;
+    memcpy(buffer, _pageBuffers[index] + offset, chunk);
+    buffer += chunk;
+    address += chunk;
+    num -= chunk;
+  }
+}
+
+// reads the next record from a sequential read, returning its length.
+uint8_t Datastore::readRecord(uint8_t* record)
+{
+  dataRead(record, 1);
+  uint8_t alreadyRead = isExtended(record[0]) ? 2 : 1;
+  if (alreadyRead == 2) dataRead(record + 1, 1);
+  uint8_t length = recordLength(record[0], record[1]);
+  if (length > alreadyRead) dataRead(record + alreadyRead, length - alreadyRead);
+  return length;
+}
+
+// returns the address of the record that ends just before the given address.
+uint32_t Datastore::previousRecordAddress(uint32_t address)
+{
+  // the length byte of an extended record, and the closing tag
+  uint8_t end[2] = {0, 0};
+  if (address >= 2) readData(address - 2, end, 2);
+  else readData(address - 1, end + 1, 1);
+  uint8_t length = recordLength(end[1], end[0]);
+  return (length > address) ? 0 : address - length;
+}
+
+// counts the entries in the records between the two addresses, not including file end markers.
+uint32_t Datastore::countEntries(uint32_t fromAddress, uint32_t toAddress)
+{
+  uint8_t record[DATASTORE_MAX_RECORD_SIZE];
+  uint32_t count = 0;
+  startDataRead(fromAddress);
+  for (uint32_t address = fromAddress; address < toAddress; )
+  {
+    address += readRecord(record);
+    if (isEntry(record[0]) && record[0] != DATASTORE_TAG_FILE_END) count++;
+  }
+  _flash->endSequentialRead();
+  return count;
+}
+
+// reads through the records from the given address, which must be the start of a record, adding
+// their entries to the counts. A file end marker starts the count for the current file again.
+// Returns the end of the last record that's wholly before toAddress.
+uint32_t Datastore::scanRecords(uint32_t fromAddress, uint32_t toAddress)
+{
+  uint8_t record[DATASTORE_MAX_RECORD_SIZE];
+  uint32_t address = fromAddress;
+  startDataRead(fromAddress);
+  while (address < toAddress)
+  {
+    uint8_t length = readRecord(record);
+    if (address + length > toAddress) break;
+    address += length;
+    if (record[0] == DATASTORE_TAG_FILE_END) _fileEntries = 0;
+    else if (isEntry(record[0]))
+    {
+      _fileEntries++;
+      _numberOfEntries++;
+    }
+  }
+  _flash->endSequentialRead();
+  return address;
+}
+
+// fills the given bytes with padding. The padding is zero, so it can be programmed over
+// whatever is already there.
+void Datastore::writePadding(uint32_t fromAddress, uint32_t toAddress)
+{
+  uint8_t padding[DATASTORE_MAX_RECORD_SIZE];
+  memset(padding, DATASTORE_TAG_PAD, sizeof(padding));
+  while (fromAddress < toAddress)
+  {
+    uint16_t num = toAddress - fromAddress;
+    uint16_t pageRemaining = AT25DF_PAGE_SIZE - (fromAddress % AT25DF_PAGE_SIZE);
+    if (num > pageRemaining) num = pageRemaining;
+    if (num > sizeof(padding)) num = sizeof(padding);
+    _flash->writePage(physicalAddress(fromAddress), padding, num);
+    fromAddress += num;
+  }
+}
+
+// writes all buffered entries out to the flash, and waits for the flash to finish. It's fine
+// to call this with a part-filled page - the rest of the page will be programmed when the
+// buffer next fills.
+void Datastore::flush()
+{
+  // the queue is emptied first so that queueing the part-filled buffer doesn't count as a stall
+  while (_queueDepth > 0) writeQueuedPage();
+  if (_bufferFill > 0) queueFillBuffer();
+  while (_queueDepth > 0) writeQueuedPage();
+  if (_pendingCheckpoint.head != 0) writeCheckpoint(&_pendingCheckpoint);
+#ifdef DATASTORE_RING_MODE
+  if (_tailMoved) updateTail();
+#endif
+  _flash->waitForPendingProgram();
+}
+
+// this should be called every time around the main loop. It moves the write queue on by at
+// most one step: either checking whether the flash has finished the last page, or starting
+// the next page, or writing a journal checkpoint. The flash isn't polled until the last page
+// program should have finished, to save wasting time on the SPI bus. In ring mode, when there's
+// nothing else to do, it erases the sector ahead of the write head.
+void Datastore::service()
+{
+  if (_queueDepth == 0 && _pendingCheckpoint.head == 0 && !isSectorWorkDue()) return;
+  if ((int32_t)(micros() - _nextPollTime) < 0) return;
+  if (_flash->isBusy())
+  {
+    _nextPollTime = micros() + AT25DF_STATUS_POLL_INTERVAL_US;
+    return;
+  }
+  if (_queueDepth > 0) writeQueuedPage();
+  else if (_pendingCheckpoint.head != 0) writeCheckpoint(&_pendingCheckpoint);
+#ifdef DATASTORE_RING_MODE
+  else if (_tailMoved) updateTail();
+  else eraseNextSector();
+#endif
+}
+
+// in ring mode there's always a whole sector erased ahead of the one that's being written, so that
+// writing never has to wait for an erase.
+boolean Datastore::isSectorWorkDue()
+{
+#ifdef DATASTORE_RING_MODE
+  return (_tailMoved || (!_oldData && _erasedTo < _firstFreeAddress + DATASTORE_SECTOR_SIZE));
+#else
+  return false;
+#endif
+}
+
+// erases the next sector after the erased space, which holds the oldest data in the log once it has
+// wrapped around. The erase goes on in the background, like a page program. The tail moves on past
+// the erased data, but the sector record at the new tail can't be read until the erase has finished.
+void Datastore::eraseNextSector()
+{
+#ifdef DATASTORE_RING_MODE
+  _flash->startBlockErase(physicalAddress(_erasedTo));
+  _erasedTo += DATASTORE_SECTOR_SIZE;
+  if (_erasedTo > DATASTORE_DATA_SIZE && _erasedTo - DATASTORE_DATA_SIZE > _tail)
+  {
+    _tail = _erasedTo - DATASTORE_DATA_SIZE;
+    _tailMoved = true;
+  }
+  _nextPollTime = micros() + AT25DF_BLOCK_ERASE_TIME_US;
+#endif
+}
+
+// gets the entry counts at the new tail, and drops any files that have been overwritten completely.
+void Datastore::updateTail()
+{
+#ifdef DATASTORE_RING_MODE
+  _tailMoved = false;
+  if (!readSectorRecord(physicalAddress(_tail), &_tailSector)) memset(&_tailSector, 0, sizeof(_tailSector));
+  dropExpiredFiles();
+#endif
+}
+
+// reads the sector record at the start of each sector. The one furthest on in the log is the newest,
+// which the write head is in, and the earliest one is the tail. Sectors that have been erased, or that
+// were written before ring mode was turned on, don't have one. Returns false if there aren't any.
+boolean Datastore::findSectors(JournalRecord* newest)
+{
+  boolean found = false;
+  for (uint32_t address = 0; address < DATASTORE_DATA_SIZE; address += DATASTORE_SECTOR_SIZE)
+  {
+    JournalRecord record;
+    if (!readSectorRecord(address, &record)) continue;
+    if (!found || record.head > newest->head) *newest = record;
+    if (!found || record.head < _tail)
     {
-      // not a blank entry, so clear the blank entry flag
-      previousEntryBlank = false;
+      _tail = record.head;
+      _tailSector = record;
+    }
+    found = true;
+  }
+  return found;
+}
+
+boolean Datastore::readSectorRecord(uint32_t physicalSectorAddress, JournalRecord* record)
+{
+  uint8_t buffer[DATASTORE_SECTOR_RECORD_SIZE];
+  _flash->readArray(physicalSectorAddress, buffer, sizeof(buffer));
+  if (buffer[0] != DATASTORE_TAG_SECTOR || buffer[1] != sizeof(buffer)) return false;
+  if (buffer[sizeof(buffer) - 2] != sizeof(buffer) || buffer[sizeof(buffer) - 1] != DATASTORE_TAG_SECTOR) return false;
+  memcpy(record, buffer + 2, DATASTORE_SECTOR_RECORD_CONTENTS_SIZE);
+  return (physicalAddress(record->head) == physicalSectorAddress);
+}
+
+// the newest sector was erased before it was written, so the data in it ends at the last byte that's
+// been written, just like the log as a whole in normal mode.
+uint32_t Datastore::findEndOfSector(uint32_t sectorAddress)
+{
+  uint32_t physicalStart = physicalAddress(sectorAddress);
+  uint32_t physicalEnd = findEndOfData(physicalStart, physicalStart + DATASTORE_SECTOR_SIZE);
+  if (physicalEnd < physicalStart) physicalEnd = physicalStart;
+  return sectorAddress + (physicalEnd - physicalStart);
+}
+
+// the number of pages waiting to be written to the flash
+uint8_t Datastore::getWriteQueueDepth()
+{
+  return _queueDepth;
+}
+
+// the number of times that addEntry() has had to wait for the flash because the write
+// queue was full. If this is going up, then service() isn't being called often enough.
+uint32_t Datastore::getWriteStalls()
+{
+  return _writeStalls;
+}
+
+uint8_t Datastore::fillBufferIndex()
+{
+  return (_queueHead + _queueDepth) % DATASTORE_WRITE_QUEUE_LENGTH;
+}
+
+// puts the buffer that's being filled on the end of the write queue. If that was the last
+// free buffer then we have no choice but to write out the oldest page straight away. The
+// page remembers the end of the last whole record in it, in case it needs to be checkpointed.
+void Datastore::queueFillBuffer()
+{
+  uint8_t index = fillBufferIndex();
+  _pageAddresses[index] = _bufferAddress;
+  _pageFills[index] = _bufferFill;
+  _pageCheckpoints[index] = _recordEnd;
+  _queueDepth++;
+  _bufferFill = 0;
+  if (_queueDepth == DATASTORE_WRITE_QUEUE_LENGTH)
+  {
+    _writeStalls++;
+    writeQueuedPage();
+  }
+}
+
+// starts the flash programming the oldest page in the queue. This will wait if the flash is
+// still busy with the previous page. A journal checkpoint is due whenever the log passes a
+// checkpoint interval boundary - it's written by service() once the page is safely in the flash.
+void Datastore::writeQueuedPage()
+{
+#ifdef DATASTORE_RING_MODE
+  // the sector is usually erased well before this, but it's possible to get here first if service()
+  // isn't being called
+  while (_pageAddresses[_queueHead] >= _erasedTo) eraseNextSector();
+#endif
+  _flash->startPageProgram(physicalAddress(_pageAddresses[_queueHead]), _pageBuffers[_queueHead], _pageFills[_queueHead]);
+  JournalRecord* checkpoint = &_pageCheckpoints[_queueHead];
+  if ((checkpoint->head / DATASTORE_CHECKPOINT_INTERVAL) > (_lastCheckpoint / DATASTORE_CHECKPOINT_INTERVAL)) _pendingCheckpoint = *checkpoint;
+  _queueHead = (_queueHead + 1) % DATASTORE_WRITE_QUEUE_LENGTH;
+  _queueDepth--;
+  _nextPollTime = micros() + AT25DF_PAGE_PROGRAM_TIME_US;
+}
+
+void Datastore::addFileEndMarker()
+{
+  // A file end marker is a single 0xff byte, which can't be the start of any other record.
+  // As the flash erases all bytes to 0xff we need do no writing, just move the
+  // _firstFreeAddress pointer. The buffered entries must go out first, as the buffer can
+  // only hold contiguous data, and they must be in the flash before the directory says
+  // that the file is complete. The marker can't be the first thing in a sector, so one is
+  // started first if need be.
+  if (_oldData) return;
+  reserveSpace(1);
+  flush();
+  if (_fileOpen)
+  {
+    endFile(_numberOfFiles - 1, _firstFreeAddress, _fileEntries);
+    _fileOpen = false;
+  }
+  _firstFreeAddress++;
+  _fileEntries = 0;
+  _recordEnd.head = _firstFreeAddress;
+  _recordEnd.fileEntries = 0;
+  _recordEnd.totalEntries = _numberOfEntries;
+  writeCheckpoint(&_recordEnd);
+}
+
+// the write head. The data just before it might still be in the page buffers, which the reads
+// take it from, so it doesn't have to wait for the flash.
+uint32_t Datastore::getHead()
+{
+  return _firstFreeAddress;
+}
+
+// the oldest data in the log
+uint32_t Datastore::getTail()
+{
+  return _tail;
+}
+
+// opens a cursor at the start of the log, for reading forwards. Reading forwards streams the data out
+// of the flash with a single read command, which is much quicker than reading each entry separately,
+// and the read only has to be started again if something else has used the flash in the meantime.
+void Datastore::openCursor(DatastoreCursor* cursor)
+{
+  cursor->end = getHead();
+  cursor->address = _tail;
+  memset(&cursor->_entry, 0, sizeof(LogEntry));
+}
+
+// opens a cursor at the end of the log, for reading backwards.
+void Datastore::openReverseCursor(DatastoreCursor* cursor)
+{
+  cursor->end = getHead();
+  cursor->address = cursor->end;
+  memset(&cursor->_entry, 0, sizeof(LogEntry));
+}
+
+// lets a forward read carry on into data that's been logged since the cursor was opened.
+void Datastore::extendCursor(DatastoreCursor* cursor)
+{
+  cursor->end = getHead();
+}
+
+// stops the flash's sequential read, if it's this cursor's. The cursor can still be read from
+// afterwards, it just has to start the read again.
+void Datastore::closeCursor(DatastoreCursor* cursor)
+{
+  if (_readCursor != cursor) return;
+  _flash->endSequentialRead();
+  _readCursor = NULL;
+}
+
+// the end can only have gone backwards if the log has been erased, in which case there's nothing
+// left to read.
+uint32_t Datastore::cursorEnd(DatastoreCursor* cursor)
+{
+  return (cursor->end < _firstFreeAddress) ? cursor->end : _firstFreeAddress;
+}
+
+// gets the flash's sequential read to the cursor. If the data under the cursor has been overwritten
+// it skips on to the tail, which is the start of a sector, so decoding can start again from there.
+void Datastore::seekCursor(DatastoreCursor* cursor)
+{
+  if (cursor->address < _tail)
+  {
+    cursor->address = _tail;
+    memset(&cursor->_entry, 0, sizeof(LogEntry));
+  }
+  if (_readCursor == cursor && _dataReadAddress == cursor->address) return;
+  startDataRead(cursor->address);
+  _readCursor = cursor;
+}
+
+// returns false if there were only padding and extended records left before the end of the cursor,
+// in which case the buffer is left alone. entryAvailable() can't see that without reading them.
+boolean Datastore::getNextEntry(DatastoreCursor* cursor, LogEntry* buffer)
+{
+  uint8_t record[DATASTORE_MAX_RECORD_SIZE];
+  seekCursor(cursor);
+  // padding and extended records are passed over, but headers still have to be decoded
+  while (cursor->address < cursorEnd(cursor))
+  {
+    cursor->address += readRecord(record);
+    decodeRecord(record, &cursor->_entry);
+    if (isEntry(record[0]))
+    {
+      *buffer = cursor->_entry;
+      return true;
+    }
+  }
+  return false;
+}
+
+// reads up to maxBytes of raw log data, stopping at the end of the cursor, and returns the number
+// of bytes read. This is for shifting the log in bulk, like when downloading.
+uint16_t Datastore::readBlock(DatastoreCursor* cursor, uint8_t* buffer, uint16_t maxBytes)
+{
+  seekCursor(cursor);
+  uint32_t end = cursorEnd(cursor);
+  if (cursor->address >= end) return 0;
+  uint32_t remaining = end - cursor->address;
+  uint16_t num = (remaining < maxBytes) ? remaining : maxBytes;
+  dataRead(buffer, num);
+  cursor->address += num;
+  return num;
+}
+
+boolean Datastore::entryAvailable(DatastoreCursor* cursor)
+{
+  if (cursor->address < _tail) cursor->address = _tail;
+  return (cursor->address < cursorEnd(cursor));
+}
+
+// records can be stepped over backwards, but most of them only make sense relative to the
+// ones before, so they're decoded with decodeEntry().
+void Datastore::getPreviousEntry(DatastoreCursor* cursor, LogEntry* buffer)
+{
+  uint32_t recordAddress = cursor->address;
+  uint8_t tag;
+  do
+  {
+    recordAddress = previousRecordAddress(recordAddress);
+    readData(recordAddress, &tag, 1);
+  }
+  while (!isEntry(tag) && recordAddress > _tail);
+  decodeEntry(recordAddress, buffer);
+  cursor->address = recordAddress;
+}
+
+// decodes the entry whose record is at the given address. We step back to the keyframe that the
+// record depends on and decode forwards from there. Keyframes are frequent, so this never has to
+// look far. A keyframe has every field in the file, so its tag gives the file's channels, which
+// are returned.
+uint8_t Datastore::decodeEntry(uint32_t recordAddress, LogEntry* buffer)
+{
+  uint8_t tag;
+  readData(recordAddress, &tag, 1);
+  uint32_t address = recordAddress;
+  while (!(isKeyframe(tag) || tag == DATASTORE_TAG_FILE_END) && address > _tail)
+  {
+    address = previousRecordAddress(address);
+    readData(address, &tag, 1);
+  }
+  uint8_t channels = isKeyframe(tag) ? ((tag & DATASTORE_ALL_CHANNELS) | DATASTORE_CHANNEL_PRESSURE) : DATASTORE_ALL_CHANNELS;
+  uint8_t record[DATASTORE_MAX_RECORD_SIZE];
+  // any channels that aren't in the file aren't in the keyframe either, so they read as zero, just
+  // as if we'd started from the file header
+  memset(buffer, 0, sizeof(LogEntry));
+  startDataRead(address);
+  while (address <= recordAddress)
+  {
+    address += readRecord(record);
+    decodeRecord(record, buffer);
+  }
+  _flash->endSequentialRead();
+  return channels;
+}
+
+// the log starts with a header, and in ring mode every sector starts with a sector record, so
+// there might be records before the cursor that aren't entries. If the data before the cursor has
+// been overwritten then there's nothing more to read.
+boolean Datastore::entryReverseAvailable(DatastoreCursor* cursor)
+{
+  uint32_t address = (cursor->address < cursorEnd(cursor)) ? cursor->address : cursorEnd(cursor);
+  while (address > _tail)
+  {
+    address = previousRecordAddress(address);
+    uint8_t tag;
+    readData(address, &tag, 1);
+    if (isEntry(tag)) return true;
+  }
+  return false;
+}
+
+// -- ranges
+// Parts of the log can be read without going through everything before them. The journal's
+// checkpoints say how many entries there were at points through the log, so a range is found by
+// starting from the nearest checkpoint and reading on from there, which is never more than
+// DATASTORE_CHECKPOINT_INTERVAL bytes. Entries are numbered from the oldest one in the log.
+
+// the address of the record boundary that comes before the given entry, or the write head if
+// there aren't that many entries.
+uint32_t Datastore::findEntry(uint32_t entry)
+{
+  uint32_t target = entry + _tailSector.totalEntries;
+  JournalRecord checkpoint;
+  findCheckpoint(target, true, &checkpoint);
+  return skipEntries(checkpoint.head, target - checkpoint.totalEntries);
+}
+
+// the first record boundary at or after the given address.
+uint32_t Datastore::findRecord(uint32_t address)
+{
+  if (address < _tail) return _tail;
+  if (address >= _firstFreeAddress) return _firstFreeAddress;
+  JournalRecord checkpoint;
+  findCheckpoint(address, false, &checkpoint);
+  uint8_t record[DATASTORE_MAX_RECORD_SIZE];
+  uint32_t recordAddress = checkpoint.head;
+  startDataRead(recordAddress);
+  while (recordAddress < address) recordAddress += readRecord(record);
+  _flash->endSequentialRead();
+  return recordAddress;
+}
+
+// reads on from the record boundary at the given address, past the given number of entries, and
+// returns the address after the last of them. It stops at the write head.
+uint32_t Datastore::skipEntries(uint32_t address, uint32_t entries)
+{
+  uint8_t record[DATASTORE_MAX_RECORD_SIZE];
+  startDataRead(address);
+  while (entries > 0 && address < _firstFreeAddress)
+  {
+    address += readRecord(record);
+    if (isEntry(record[0]) && record[0] != DATASTORE_TAG_FILE_END) entries--;
+  }
+  _flash->endSequentialRead();
+  return address;
+}
+
+// finds the latest checkpoint that's not after the given point in the log, which is an address, or
+// with byEntries, a count of entries. Each sector of the journal is in order, so they can be binary
+// searched. If there isn't a checkpoint for the part of the log that's left, the tail is used.
+void Datastore::findCheckpoint(uint32_t target, boolean byEntries, JournalRecord* checkpoint)
+{
+  memset(checkpoint, 0, sizeof(JournalRecord));
+  checkpoint->head = _tail;
+  checkpoint->totalEntries = _tailSector.totalEntries;
+  for (uint8_t sector = 0; sector < 2; sector++)
+  {
+    uint32_t sectorAddress = DATASTORE_JOURNAL_ADDRESS + sector * DATASTORE_CHECKPOINTS_PER_SECTOR * sizeof(JournalRecord);
+    uint32_t low = 0;
+    uint32_t high = countUsedRecords(sectorAddress, sizeof(JournalRecord), DATASTORE_CHECKPOINTS_PER_SECTOR);
+    JournalRecord record;
+    while (low < high)
+    {
+      uint32_t mid = (low + high) / 2;
+      _flash->readArray(sectorAddress + mid * sizeof(JournalRecord), (uint8_t*)&record, sizeof(JournalRecord));
+      if ((byEntries ? record.totalEntries : record.head) <= target) low = mid + 1;
+      else high = mid;
+    }
+    // a damaged record is passed over for the one before
+    for (uint32_t i = low; i > 0; i--)
+    {
+      _flash->readArray(sectorAddress + (i - 1) * sizeof(JournalRecord), (uint8_t*)&record, sizeof(JournalRecord));
+      if (record.check != checkpointCheck(&record)) continue;
+      if (record.head > checkpoint->head && record.head <= _firstFreeAddress) *checkpoint = record;
+      break;
+    }
+  }
+}
+
+// opens a cursor on part of the log, from a record boundary up to the given address. A range can
+// start part way through a file, so its first entry is given as a file header and a keyframe, which
+// are put in the prefix buffer, and the cursor starts after it. Anything before the first entry is
+// passed over, as the header takes its place. If the range starts with a file end marker, or has no
+// entries, then there's no prefix. The start is moved on to the oldest data if it's been overwritten,
+// and back to the end if it's past it, so it's where the range really starts. Returns the length of
+// the prefix.
+uint8_t Datastore::openRangeCursor(DatastoreCursor* cursor, uint32_t* start, uint32_t toAddress, uint8_t* prefix)
+{
+  if (toAddress > _firstFreeAddress) toAddress = _firstFreeAddress;
+  if (*start < _tail) *start = _tail;
+  if (*start > toAddress) *start = toAddress;
+  uint32_t fromAddress = *start;
+  cursor->address = fromAddress;
+  cursor->end = toAddress;
+  memset(&cursor->_entry, 0, sizeof(LogEntry));
+  uint8_t record[DATASTORE_MAX_RECORD_SIZE];
+  uint32_t address = fromAddress;
+  startDataRead(address);
+  while (address < toAddress)
+  {
+    uint8_t length = readRecord(record);
+    if (isEntry(record[0]))
+    {
+      if (record[0] == DATASTORE_TAG_FILE_END) break;
+      _flash->endSequentialRead();
+      uint8_t channels = decodeEntry(address, &cursor->_entry);
+      uint8_t prefixLength = encodeHeader(channels, prefix);
+      prefixLength += encodeKeyframe(&cursor->_entry, channels, prefix + prefixLength);
+      cursor->address = address + length;
+      return prefixLength;
+    }
+    address += length;
+  }
+  _flash->endSequentialRead();
+  return 0;
+}
+
+// this function finds the end of the data, looking no earlier than the given address, which must
+// be somewhere in the used part of the flash, and no further than toAddress. Every record ends with
+// a byte that isn't 0xff, so the data ends after the last byte that's been written.
+// Rather than reading every byte, we first find the first erased page, and then only need to
+// look for the last written byte in the page before it.
+uint32_t Datastore::findEndOfData(uint32_t fromAddress, uint32_t toAddress)
+{
+  uint32_t firstErasedPage = findFirstErasedPage(fromAddress / AT25DF_PAGE_SIZE, toAddress / AT25DF_PAGE_SIZE);
+  if (firstErasedPage == 0) return 0;
+  uint32_t pageAddress = (firstErasedPage - 1) * AT25DF_PAGE_SIZE;
+  byte buffer[DATASTORE_SCAN_BUFFER_SIZE];
+  int16_t lastWritten = -1;
+  _flash->startSequentialRead(pageAddress);
+  for (uint16_t offset = 0; offset < AT25DF_PAGE_SIZE; offset += DATASTORE_SCAN_BUFFER_SIZE)
+  {
+    _flash->sequentialRead(buffer, DATASTORE_SCAN_BUFFER_SIZE);
+    for (int i = 0; i < DATASTORE_SCAN_BUFFER_SIZE; i++) if (buffer[i] != 0xff) lastWritten = offset + i;
+  }
+  _flash->endSequentialRead();
+  // this can only happen if the search started on an erased page
+  if (lastWritten < 0) return fromAddress;
+  return pageAddress + lastWritten + 1;
+}
+
+// The log is only ever appended to, so every page after the end of the data is erased, and every
+// page before it has something in it. We step forward from the given page in increasing strides
+// until we hit an erased page, and then binary search back. This is quick if the given page is near
+// the end of the data, and never worse than a binary search over the whole flash.
+uint32_t Datastore::findFirstErasedPage(uint32_t fromPage, uint32_t lastPage)
+{
+  // all pages before low are used, and high is erased, or the end of the area being searched
+  uint32_t low = fromPage;
+  uint32_t high = fromPage;
+  uint32_t stride = 1;
+  while (high < lastPage && !isPageErased(high))
+  {
+    low = high + 1;
+    high += stride;
+    stride *= 2;
+  }
+  if (high > lastPage) high = lastPage;
+  while (low < high)
+  {
+    uint32_t mid = (low + high) / 2;
+    if (isPageErased(mid)) high = mid;
+    else low = mid + 1;
+  }
+  return low;
+}
+
+boolean Datastore::isPageErased(uint32_t page)
+{
+  byte buffer[DATASTORE_SCAN_BUFFER_SIZE];
+  boolean erased = true;
+  _flash->startSequentialRead(page * AT25DF_PAGE_SIZE);
+  for (uint32_t offset = 0; erased && offset < AT25DF_PAGE_SIZE; offset += DATASTORE_SCAN_BUFFER_SIZE)
+  {
+    _flash->sequentialRead(buffer, DATASTORE_SCAN_BUFFER_SIZE);
+    for (int i = 0; i < DATASTORE_SCAN_BUFFER_SIZE; i++) if (buffer[i] != 0xff) erased = false;
+  }
+  _flash->endSequentialRead();
+  return erased;
+}
+
+// -- directory and journal
+// Both of these are rings of two sectors, each of which is filled in order, so the number of records in
+// a sector can be found by binary search for the first one that has never been written.
+uint32_t Datastore::countUsedRecords(uint32_t baseAddress, uint16_t recordSize, uint32_t maxRecords)
+{
+  uint32_t low = 0;
+  uint32_t high = maxRecords;
+  while (low < high)
+  {
+    uint32_t mid = (low + high) / 2;
+    uint32_t firstWord;
+    _flash->readArray(baseAddress + mid * recordSize, (uint8_t*)&firstWord, sizeof(firstWord));
+    if (firstWord == 0xffffffff) high = mid;
+    else low = mid + 1;
+  }
+  return low;
+}
+
+// when the directory or journal moves on to the next sector, it has to be erased first if it has the
+// oldest records in it. That's rare, so we just wait for it. Returns whether it was erased.
+boolean Datastore::eraseMetadataSector(uint32_t address)
+{
+  if ((address % DATASTORE_SECTOR_SIZE) != 0) return false;
+  uint32_t firstWord;
+  _flash->readArray(address, (uint8_t*)&firstWord, sizeof(firstWord));
+  if (firstWord == 0xffffffff) return false;
+  _flash->startBlockErase(address);
+  _flash->waitForPendingProgram();
+  return true;
+}
+
+// a simple check byte for the metadata records. It's chosen so that erased (all 0xff) data doesn't
+// pass the check.
+uint8_t Datastore::checkByte(uint8_t* data, uint8_t num)
+{
+  uint8_t sum = 0;
+  for (int i = 0; i < num; i++) sum += data[i];
+  return ~sum;
+}
+
+// if both directory sectors have records in them, then the one with the later start address is the
+// newer one, and the other must be full.
+void Datastore::mountDirectory()
+{
+  uint32_t used[2];
+  uint32_t firstStart[2];
+  for (uint8_t sector = 0; sector < 2; sector++)
+  {
+    uint32_t address = DATASTORE_DIRECTORY_ADDRESS + sector * DATASTORE_SECTOR_SIZE;
+    used[sector] = countUsedRecords(address, sizeof(FileRecord), DATASTORE_FILES_PER_SECTOR);
+    _flash->readArray(address, (uint8_t*)&firstStart[sector], sizeof(firstStart[sector]));
+  }
+  if (used[1] > 0 && (used[0] == 0 || firstStart[1] < firstStart[0])) _firstFile = DATASTORE_FILES_PER_SECTOR;
+  else _firstFile = 0;
+  _numberOfFiles = used[0] + used[1];
+}
+
+// in ring mode, files that have been completely overwritten are dropped from the front of the directory.
+void Datastore::dropExpiredFiles()
+{
+  while (_numberOfFiles > 0 && getFileEndAddress(0) < _tail)
+  {
+    _firstFile = (_firstFile + 1) % DATASTORE_MAX_FILES;
+    _numberOfFiles--;
+  }
+}
+
+uint32_t Datastore::fileSlot(uint32_t file)
+{
+  return (_firstFile + file) % DATASTORE_MAX_FILES;
+}
+
+void Datastore::readFileRecord(uint32_t file, FileRecord* record)
+{
+  _flash->readArray(DATASTORE_DIRECTORY_ADDRESS + fileSlot(file) * sizeof(FileRecord), (uint8_t*)record, sizeof(FileRecord));
+}
+
+boolean Datastore::isStartValid(FileRecord* record)
+{
+  return (record->startCheck == checkByte((uint8_t*)&record->startAddress, sizeof(record->startAddress)));
+}
+
+boolean Datastore::isEndValid(FileRecord* record)
+{
+  return (record->endCheck == checkByte((uint8_t*)&record->endAddress, sizeof(record->endAddress) + sizeof(record->numberOfEntries)));
+}
+
+// the fields that aren't being written are left as 0xff, which leaves the flash untouched, so
+// the two halves of a record can be programmed at different times.
+boolean Datastore::startFile(uint32_t startAddress)
+{
+  uint32_t slot = fileSlot(_numberOfFiles);
+#ifdef DATASTORE_RING_MODE
+  // the oldest files lose their directory records to make room, even if some of their data is still there
+  if (eraseMetadataSector(DATASTORE_DIRECTORY_ADDRESS + slot * sizeof(FileRecord)))
+  {
+    while (_numberOfFiles > 0 && (fileSlot(0) / DATASTORE_FILES_PER_SECTOR) == (slot / DATASTORE_FILES_PER_SECTOR))
+    {
+      _firstFile = (_firstFile + 1) % DATASTORE_MAX_FILES;
+      _numberOfFiles--;
+    }
+  }
+#else
+  if (_numberOfFiles >= DATASTORE_MAX_FILES) return false;
+#endif
+  FileRecord record;
+  memset(&record, 0xff, sizeof(record));
+  record.startAddress = startAddress;
+  record.startCheck = checkByte((uint8_t*)&record.startAddress, sizeof(record.startAddress));
+  _flash->writePage(DATASTORE_DIRECTORY_ADDRESS + slot * sizeof(FileRecord), (uint8_t*)&record, sizeof(record));
+  _numberOfFiles++;
+  _fileOpen = true;
+  return true;
+}
+
+// the end address is the address of the file end marker.
+void Datastore::endFile(uint32_t file, uint32_t endAddress, uint32_t numberOfEntries)
+{
+  FileRecord record;
+  memset(&record, 0xff, sizeof(record));
+  record.endAddress = endAddress;
+  record.numberOfEntries = numberOfEntries;
+  record.endCheck = checkByte((uint8_t*)&record.endAddress, sizeof(record.endAddress) + sizeof(record.numberOfEntries));
+  _flash->writePage(DATASTORE_DIRECTORY_ADDRESS + fileSlot(file) * sizeof(FileRecord), (uint8_t*)&record, sizeof(record));
+}
+
+// if the power went off while a record was being written then its check will fail. In that case
+// we can still work out where the file is from its neighbours. In ring mode the start of the oldest
+// file might have been overwritten, in which case it starts at the tail.
+uint32_t Datastore::getFileStartAddress(uint32_t file)
+{
+  FileRecord record;
+  readFileRecord(file, &record);
+  uint32_t address;
+  if (isStartValid(&record)) address = record.startAddress;
+  else if (file == 0) address = _tail;
+  else
+  {
+    readFileRecord(file - 1, &record);
+    if (isEndValid(&record)) address = record.endAddress + 1;
+    else address = getFileStartAddress(file - 1);
+  }
+  return (address < _tail) ? _tail : address;
+}
+
+// returns the address of the given file's end marker, or for a file that's still being written,
+// the first free address.
+uint32_t Datastore::getFileEndAddress(uint32_t file)
+{
+  if (file == _numberOfFiles - 1 && _fileOpen) return _firstFreeAddress;
+  FileRecord record;
+  readFileRecord(file, &record);
+  if (isEndValid(&record)) return record.endAddress;
+  if (file == _numberOfFiles - 1) return _firstFreeAddress - 1;
+  readFileRecord(file + 1, &record);
+  if (isStartValid(&record)) return record.startAddress - 1;
+  return getFileEndAddress(file + 1);
+}
+
+// the entries can't be worked out from the addresses, as records are different lengths, so they are
+// counted as they're written. If the file's record was damaged then they have to be counted again.
+uint32_t Datastore::getFileNumberOfEntries(uint32_t file)
+{
+  FileRecord record;
+  readFileRecord(file, &record);
+  uint32_t entries;
+  if (file == _numberOfFiles - 1 && _fileOpen) entries = _fileEntries;
+  else if (isEndValid(&record)) entries = record.numberOfEntries;
+  else return countEntries(getFileStartAddress(file), getFileEndAddress(file));
+  // if the start of the file has been overwritten, then the sector record at the tail says how
+  // many of its entries went with it
+  if (file == 0 && (!isStartValid(&record) || record.startAddress < _tail) && _tailSector.fileEntries <= entries) entries -= _tailSector.fileEntries;
+  return entries;
+}
+
+// journal checkpoints record that the log has been written at least as far as the given address,
+// which is always the end of a whole record, and how many entries there were at that point.
+// Only the newest checkpoint is ever needed, so the oldest ones are erased when the journal wraps
+// around.
+void Datastore::writeCheckpoint(JournalRecord* checkpoint)
+{
+  JournalRecord record = *checkpoint;
+  _pendingCheckpoint.head = 0;
+  memset(record.reserved, 0xff, sizeof(record.reserved));
+  record.check = checkpointCheck(&record);
+  uint32_t address = DATASTORE_JOURNAL_ADDRESS + _journalSlot * sizeof(JournalRecord);
+  eraseMetadataSector(address);
+  _flash->writePage(address, (uint8_t*)&record, sizeof(record));
+  _journalSlot = (_journalSlot + 1) % DATASTORE_MAX_CHECKPOINTS;
+  _lastCheckpoint = record.head;
+}
+
+uint8_t Datastore::checkpointCheck(JournalRecord* record)
+{
+  return checkByte((uint8_t*)&record->head, sizeof(record->head) + sizeof(record->fileEntries) + sizeof(record->totalEntries));
+}
+
+// gets the most recent checkpoint that was completely written, which is the one with the furthest
+// head, from whichever sector it's in. The next checkpoint goes after the last one in that sector.
+// If there isn't one, then we start from the beginning of the flash.
+void Datastore::readLastCheckpoint(JournalRecord* checkpoint)
+{
+  memset(checkpoint, 0, sizeof(JournalRecord));
+  _journalSlot = 0;
+  boolean found = false;
+  for (uint8_t sector = 0; sector < 2; sector++)
+  {
+    uint32_t firstSlot = sector * DATASTORE_CHECKPOINTS_PER_SECTOR;
+    uint32_t used = countUsedRecords(DATASTORE_JOURNAL_ADDRESS + firstSlot * sizeof(JournalRecord), sizeof(JournalRecord), DATASTORE_CHECKPOINTS_PER_SECTOR);
+    for (uint32_t i = used; i > 0; i--)
+    {
+      JournalRecord record;
+      _flash->readArray(DATASTORE_JOURNAL_ADDRESS + (firstSlot + i - 1) * sizeof(JournalRecord), (uint8_t*)&record, sizeof(JournalRecord));
+      if (record.check != checkpointCheck(&record)) continue;
+      if (!found || record.head > checkpoint->head)
+      {
+        *checkpoint = record;
+        _journalSlot = (firstSlot + used) % DATASTORE_MAX_CHECKPOINTS;
+        found = true;
+      }
+      break;
     }
   }
-  // if we've got to here it means the flash is full
-  _firstFreeAddress = _readPointer;
 }
 
 uint32_t Datastore::getNumberOfFiles()
@@ -162,9 +1452,18 @@ uint32_t Datastore::getNumberOfFiles()
   return _numberOfFiles;
 }
 
+// in ring mode this is just the entries that haven't been overwritten yet.
 uint32_t Datastore::getNumberOfEntries()
 {
-  return _firstFreeAddress / DATASTORE_LOG_ENTRY_SIZE;
+  return _numberOfEntries - _tailSector.totalEntries;
+}
+
+void Datastore::makeTestEntry(int i, LogEntry* le)
+{
+  le->setPressure( i + 1 );
+  le->setTemperature( 2 * i + 1 );
+  le->setBattery( 0.1 * (double)(i + 1) );
+  le->setServo( 0 );
 }
 
 void Datastore::testWrite(int n)
@@ -172,73 +1471,134 @@ void Datastore::testWrite(int n)
   LogEntry le;
   for (int i = 0; i < n; i++)
   {
-    le.setPressure( i + 1 );
-    le.setTemperature( 2 * i + 1 );
-    le.setBattery( 0.1 * (double)(i + 1) );
+    makeTestEntry(i, &le);
 //    le.print();
     addEntry(&le);
+    if (i == n / 2) addEvent(DATASTORE_EVENT_LAUNCH);
   }
   addFileEndMarker();
 }
 
+// checks that the log holds just the one file written by testWrite(n), reading it forwards and
+// backwards at the same time, with a cursor for each.
+boolean Datastore::testRead(int n)
+{
+  LogEntry le, expected;
+  boolean ok = true;
+  DatastoreCursor forward, reverse;
+  openCursor(&forward);
+  openReverseCursor(&reverse);
+  getPreviousEntry(&reverse, &le);
+  if (!le.isFileEndMarker()) ok = false;
+  for (int i = 0; i < n && ok; i++)
+  {
+    makeTestEntry(i, &expected);
+    if (!entryAvailable(&forward) || !getNextEntry(&forward, &le)) ok = false;
+    if (memcmp(&le, &expected, sizeof(LogEntry)) != 0) ok = false;
+    makeTestEntry(n - 1 - i, &expected);
+    if (!entryReverseAvailable(&reverse)) ok = false;
+    getPreviousEntry(&reverse, &le);
+    if (memcmp(&le, &expected, sizeof(LogEntry)) != 0) ok = false;
+  }
+  closeCursor(&forward);
+  return ok;
+}
+
+// checks that a log ending in an event, rather than an entry, reads as having just the n entries
+// written before the event.
+boolean Datastore::testTrailingEvent(int n)
+{
+  LogEntry le;
+  for (int i = 0; i < n; i++)
+  {
+    makeTestEntry(i, &le);
+    addEntry(&le);
+  }
+  addEvent(DATASTORE_EVENT_LOST_MODEL_ALARM);
+  flush();
+  int count = 0;
+  DatastoreCursor cursor;
+  openCursor(&cursor);
+  while (entryAvailable(&cursor) && getNextEntry(&cursor, &le)) count++;
+  closeCursor(&cursor);
+  addFileEndMarker();
+  return (count == n && getNumberOfEntries() == (uint32_t)n);
+}
+
 void Datastore::test()
 {
   printMessage(ENTRY_SIZE_MESSAGE);
-  Serial.println(DATASTORE_LOG_ENTRY_SIZE);
+  SerialOut.println(DATASTORE_LOG_ENTRY_SIZE);
   printMessage(MAX_ENTRIES_MESSAGE);
-  Serial.println(DATASTORE_MAX_ENTRIES, DEC);
+  SerialOut.println(DATASTORE_MAX_ENTRIES, DEC);
+  printMessage(ERASING_MESSAGE);
+  erase();
+  printMessage(DONE_MESSAGE);
+  printMessage(WRITING_MESSAGE);
+  testWrite(500);
+  printMessage(DONE_MESSAGE);
+  boolean ok = testRead(500);
+  printMessage(ERASING_MESSAGE);
+  erase();
+  printMessage(DONE_MESSAGE);
+  printMessage(WRITING_MESSAGE);
+  if (!testTrailingEvent(5)) ok = false;
+  printMessage(DONE_MESSAGE);
   printMessage(ERASING_MESSAGE);
   erase();
   printMessage(DONE_MESSAGE);
   printMessage(WRITING_MESSAGE);
   testWrite(1000);
-  Serial.print("f1 ");
+  SerialOut.print("f1 ");
   testWrite(1000);
-  Serial.print("f2 ");
+  SerialOut.print("f2 ");
   testWrite(2000);
-  Serial.print("f3 ");
+  SerialOut.print("f3 ");
   printMessage(DONE_MESSAGE);
   printMessage(DATASTORE_SETUP_MESSAGE);
   setup();
   printMessage(DONE_MESSAGE);
   printMessage(NUM_FILES_MESSAGE);
-  Serial.println(getNumberOfFiles(), DEC);
+  SerialOut.println(getNumberOfFiles(), DEC);
   printMessage(NUM_ENTRIES_MESSAGE);
-  Serial.println(getNumberOfEntries(), DEC);
+  SerialOut.println(getNumberOfEntries(), DEC);
+  if (getNumberOfEntries() != 4000) ok = false;
   printMessage(WRITING_MESSAGE);
   testWrite(1000);
-  Serial.print("f1 ");
+  SerialOut.print("f1 ");
   testWrite(1000);
-  Serial.print("f2 ");
+  SerialOut.print("f2 ");
   testWrite(2000);
-  Serial.print("f3 ");
+  SerialOut.print("f3 ");
   printMessage(DONE_MESSAGE);
   printMessage(DATASTORE_SETUP_MESSAGE);
   setup();
   printMessage(DONE_MESSAGE);
   printMessage(NUM_FILES_MESSAGE);
-  Serial.println(getNumberOfFiles(), DEC);
+  SerialOut.println(getNumberOfFiles(), DEC);
   printMessage(NUM_ENTRIES_MESSAGE);
-  Serial.println(getNumberOfEntries(), DEC);
+  SerialOut.println(getNumberOfEntries(), DEC);
+  if (getNumberOfEntries() != 8000) ok = false;
   
   printMessage(ERASING_MESSAGE);
   erase();
   printMessage(DONE_MESSAGE);
   
-  printMessage(TEST_PASS_MESSAGE);
+  if (ok) printMessage(TEST_PASS_MESSAGE);
+  else printMessage(TEST_FAIL_MESSAGE);
 
 }
 
 void LogEntry::print()
 {
-  Serial.print("P: ");
-  Serial.print(getPressure());
-  Serial.print(" T: ");
-  Serial.print(getTemperature());
-  Serial.print(" B: ");  
-  Serial.print(getBattery());
-  Serial.print(" S: ");
-  Serial.println(getServo(), DEC);
+  printMessage(PRESSURE_LABEL_MESSAGE);
+  SerialOut.print(getPressure());
+  printMessage(TEMPERATURE_LABEL_MESSAGE);
+  SerialOut.print(getTemperature());
+  printMessage(BATTERY_LABEL_MESSAGE);
+  SerialOut.print(getBattery());
+  printMessage(SERVO_LABEL_MESSAGE);
+  SerialOut.println(getServo(), DEC);
 }
 
 // pressure is stored as a 16-bit signed integer. The mapping
@@ -304,4 +1664,4 @@ boolean LogEntry::isFileEndMarker()
 {
   return (pressureRaw == -1 && temperatureRaw == 255);
 }
-
+
@@ -26,9 +26,110 @@
 #include "config.h"
 
 #define DATASTORE_LOG_ENTRY_SIZE sizeof(LogEntry)
-#define DATASTORE_MAX_ENTRIES (uint32_t)(((double)AT25DF_SIZE / (double)DATASTORE_LOG_ENTRY_SIZE) - 2)  // the - 2 makes sure that there are always a
-                                                                                                        // couple of null records at the end.                                                                                                     
-#define DATASTORE_MAX_ADDRESS (AT25DF_SIZE - (2 * DATASTORE_LOG_ENTRY_SIZE))                                      // biggest possible entry address                                                        
+// -- V3 log format
+// The log is a stream of variable length records. Most samples only differ from the one before in their
+// pressure, and only by a little, so the records are told apart by their first byte, the tag:
+// - 0x00: padding, which is skipped. As it's all zero bits it can be programmed over anything, which is how
+//   a record that was only partly written when the power went off gets tidied up.
+// - 0x01 - 0x7f: a pressure delta of (tag - 64), which is added to the previous pressure. The other values
+//   are unchanged.
+// - 0x80 - 0x9f: a sample record. The low bits of the tag say which fields follow it, in the order below,
+//   and any that aren't there are unchanged. The pressure is always there, either as a signed byte delta
+//   or as the absolute 16-bit value. The tag is repeated at the end of the record, so that the log can be
+//   stepped through backwards. A keyframe has every field that's in the file, and decoding can start at
+//   any keyframe.
+// - 0xa0 - 0xbf: an extended record, which isn't a sample. The tag is followed by the length of the whole
+//   record, then the contents, then the length and tag again. There are four sorts so far:
+//   - a file header, which has the format version, the channels in the file, and then the scaling of
+//     each of those channels as a pair of floats, offset and scale, where value = offset + raw * scale.
+//     The channels are the pressure (Pa), temperature (0.1C), battery (V) and servo (us, with a raw
+//     value of zero meaning that there was no signal).
+//   - an event, which has the event type, and marks the point in the log where something happened.
+//   - a sector record, which has the address in the log of the sector it starts, and the entry counts
+//     at that point, for the file being written and for the whole log.
+//   - a rate record, which has the time in ms from the entry before to each of the entries that follow
+//     it, as a signed 16-bit value, least significant byte first. There's one after the header at the
+//     start of every file, and another whenever the rate changes. A range that starts part way through
+//     a file doesn't have one until the rate next changes, so the rate has to be carried on from the
+//     data before it. A negative time means that the entries go back over time that's already been
+//     logged - that's how the entries from before a launch are stored, after the slower entries that
+//     covered the same time.
+// - 0xff: a file end marker. This is never written, it's just left erased.
+// The other tags are reserved.
+// Every file starts with a header followed by a keyframe, and there's another header if the channels
+// change. There's a keyframe at least every DATASTORE_KEYFRAME_INTERVAL records, which limits how far
+// back a reverse read has to look.
+// In ring mode every sector of the data area starts with a sector record, and if it's part way through a
+// file, the file's header, its rate and a keyframe. Records don't cross sector boundaries - the end of a sector is
+// padded instead. So the log can be read starting from any sector, which is what's needed once the start
+// of it has been overwritten.
+// Addresses in the log only ever go up. In ring mode they go past the end of the data area, and wrap
+// around to the start of the flash.
+#define DATASTORE_TAG_PAD 0x00
+#define DATASTORE_DELTA_OFFSET 64
+#define DATASTORE_TAG_MASK 0xe0
+#define DATASTORE_TAG_SAMPLE 0x80
+#define DATASTORE_FIELD_KEYFRAME 0x01
+#define DATASTORE_FIELD_TEMPERATURE 0x02
+#define DATASTORE_FIELD_BATTERY 0x04
+#define DATASTORE_FIELD_SERVO 0x08
+#define DATASTORE_FIELD_ABSOLUTE_PRESSURE 0x10
+#define DATASTORE_TAG_EXTENDED 0xa0
+#define DATASTORE_TAG_HEADER 0xa0
+#define DATASTORE_TAG_EVENT 0xa1
+#define DATASTORE_TAG_SECTOR 0xa2
+#define DATASTORE_TAG_RATE 0xa3
+#define DATASTORE_EXTENDED_OVERHEAD 4
+#define DATASTORE_TAG_FILE_END 0xff
+#define DATASTORE_FORMAT_VERSION 3
+// the channel bits are the same as the sample record field bits, except for the pressure, which
+// is in every file.
+#define DATASTORE_CHANNEL_PRESSURE 0x01
+#define DATASTORE_CHANNEL_TEMPERATURE 0x02
+#define DATASTORE_CHANNEL_BATTERY 0x04
+#define DATASTORE_CHANNEL_SERVO 0x08
+#define DATASTORE_ALL_CHANNELS 0x0f
+#define DATASTORE_NUMBER_OF_CHANNELS 4
+#define DATASTORE_CHANNEL_SCALING_SIZE (2 * sizeof(float))
+#define DATASTORE_EVENT_LAUNCH 1
+#define DATASTORE_EVENT_LOW_VOLTAGE_ALARM 2
+#define DATASTORE_EVENT_LOST_MODEL_ALARM 3
+// the biggest record is a header with every channel in it
+#define DATASTORE_MAX_RECORD_SIZE (DATASTORE_EXTENDED_OVERHEAD + 2 + (DATASTORE_NUMBER_OF_CHANNELS * DATASTORE_CHANNEL_SCALING_SIZE))
+// the biggest sample record is a keyframe with every channel in it
+#define DATASTORE_MAX_SAMPLE_SIZE 7
+// the contents of a sector record are the first three fields of a JournalRecord
+#define DATASTORE_SECTOR_RECORD_CONTENTS_SIZE 12
+#define DATASTORE_SECTOR_RECORD_SIZE (DATASTORE_EXTENDED_OVERHEAD + DATASTORE_SECTOR_RECORD_CONTENTS_SIZE)
+#define DATASTORE_KEYFRAME_INTERVAL 32
+// The top of the flash is kept for metadata, which lets the datastore be mounted, and files found, without
+// scanning the log. There are two areas, both lists of fixed size records:
+// - the directory, which has a record for each file giving its start and end addresses;
+// - the journal, which has checkpoints of the write head, written every DATASTORE_CHECKPOINT_INTERVAL
+//   bytes and whenever a file is ended, so the mount only has to look a short way for the free space.
+// Each area is two sectors, used as a ring: when one sector is full the other is erased, and the oldest
+// records in it are lost. The directory only does this in ring mode - otherwise the log is full when
+// the directory is.
+#define DATASTORE_SECTOR_SIZE AT25DF_BLOCK_SIZE
+#define DATASTORE_DIRECTORY_SIZE 8192
+#define DATASTORE_JOURNAL_SIZE 8192
+#define DATASTORE_DATA_SIZE (AT25DF_SIZE - DATASTORE_DIRECTORY_SIZE - DATASTORE_JOURNAL_SIZE)
+#define DATASTORE_DIRECTORY_ADDRESS DATASTORE_DATA_SIZE
+#define DATASTORE_JOURNAL_ADDRESS (DATASTORE_DIRECTORY_ADDRESS + DATASTORE_DIRECTORY_SIZE)
+#define DATASTORE_MAX_FILES (DATASTORE_DIRECTORY_SIZE / sizeof(FileRecord))
+#define DATASTORE_MAX_CHECKPOINTS (DATASTORE_JOURNAL_SIZE / sizeof(JournalRecord))
+#define DATASTORE_FILES_PER_SECTOR (DATASTORE_SECTOR_SIZE / sizeof(FileRecord))
+#define DATASTORE_CHECKPOINTS_PER_SECTOR (DATASTORE_SECTOR_SIZE / sizeof(JournalRecord))
+#define DATASTORE_CHECKPOINT_INTERVAL 4096
+
+#define DATASTORE_MAX_ENTRIES (uint32_t)(DATASTORE_DATA_SIZE - (2 * DATASTORE_MAX_RECORD_SIZE) - 1)  // at one byte per entry, which is the best case. In
+                                                                                                  // practice it'll be a bit less.
+#define DATASTORE_MAX_ADDRESS (DATASTORE_DATA_SIZE - (2 * DATASTORE_MAX_RECORD_SIZE) - 1)              // biggest possible record address, leaving room
+                                                                                                  // for a header, a record and a file end marker.
+// the biggest prefix that a range can start with, which is a header and a keyframe
+#define DATASTORE_MAX_RANGE_PREFIX_SIZE (DATASTORE_MAX_RECORD_SIZE + DATASTORE_MAX_SAMPLE_SIZE)
+// the size of the chunks that pages are read in when looking for erased pages
+#define DATASTORE_SCAN_BUFFER_SIZE 32
 
 class LogEntry
 {
@@ -44,36 +145,207 @@ class LogEntry
     void setServo(uint16_t servo);
     boolean isFileEndMarker();
   private:
+    friend class Datastore;
     int16_t pressureRaw;
     uint8_t temperatureRaw;
     uint8_t batteryRaw;
     uint8_t servoRaw;
 } __attribute__ ((__packed__)); // this is to force the compiler not to pad the data structure. It probably makes no difference on AVR-GCC.
 
+// The first half of a file record is written when the file is started, and the second half when it's
+// ended. Each half has a check byte, so that a half-written record can be spotted if the power goes
+// at the wrong moment.
+class FileRecord
+{
+  public:
+    uint32_t startAddress;
+    uint8_t startCheck;
+    uint32_t endAddress;
+    uint32_t numberOfEntries;
+    uint8_t endCheck;
+    uint8_t reserved[2];
+} __attribute__ ((__packed__));
+
+// the entry counts in a checkpoint are for the file that was being written, and for the whole log.
+class JournalRecord
+{
+  public:
+    uint32_t head;
+    uint32_t fileEntries;
+    uint32_t totalEntries;
+    uint8_t reserved[3];
+    uint8_t check;
+} __attribute__ ((__packed__));
+
+// A cursor is one reader's place in the log, so any number of reads can go on at once, and alongside
+// logging. A cursor reads up to the end of the data that was in the flash when it was opened, or last
+// extended. In ring mode the data under a cursor can be overwritten, in which case it skips on to the
+// oldest data left. Cursors should be opened again after the log is erased.
+class DatastoreCursor
+{
+  public:
+    uint32_t address;
+    uint32_t end;
+  private:
+    friend class Datastore;
+    // the entry most recently decoded by a forward read
+    LogEntry _entry;
+};
+
 class Datastore
 {
   public:
     Datastore(AT25DF* flash);
     void setup();
     boolean addEntry(LogEntry* logEntry);
+    boolean addEvent(uint8_t event);
+    void setChannels(uint8_t channels);
+    void setInterval(int16_t intervalMS);
     void addFileEndMarker();
-    void startRead();
-    void getNextEntry(LogEntry* buffer);
-    boolean entryAvailable();
-    void startReverseRead();
-    void getPreviousEntry(LogEntry* buffer);
-    boolean entryReverseAvailable();
+    void flush();
+    void service();
+    uint8_t getWriteQueueDepth();
+    uint32_t getWriteStalls();
+    uint32_t getHead();
+    uint32_t getTail();
+    void openCursor(DatastoreCursor* cursor);
+    void openReverseCursor(DatastoreCursor* cursor);
+    void extendCursor(DatastoreCursor* cursor);
+    void closeCursor(DatastoreCursor* cursor);
+    boolean getNextEntry(DatastoreCursor* cursor, LogEntry* buffer);
+    boolean entryAvailable(DatastoreCursor* cursor);
+    uint16_t readBlock(DatastoreCursor* cursor, uint8_t* buffer, uint16_t maxBytes);
+    void getPreviousEntry(DatastoreCursor* cursor, LogEntry* buffer);
+    boolean entryReverseAvailable(DatastoreCursor* cursor);
+    uint32_t findEntry(uint32_t entry);
+    uint32_t findRecord(uint32_t address);
+    uint32_t skipEntries(uint32_t address, uint32_t entries);
+    uint32_t countEntries(uint32_t fromAddress, uint32_t toAddress);
+    uint8_t openRangeCursor(DatastoreCursor* cursor, uint32_t* start, uint32_t toAddress, uint8_t* prefix);
+    uint8_t recordLength(uint8_t tag, uint8_t extendedLength);
     void erase();
     uint32_t getNumberOfFiles();
     uint32_t getNumberOfEntries();
+    uint32_t getFileStartAddress(uint32_t file);
+    uint32_t getFileEndAddress(uint32_t file);
+    uint32_t getFileNumberOfEntries(uint32_t file);
     void testWrite(int n);
+    boolean testRead(int n);
+    boolean testTrailingEvent(int n);
     void test();
   private:
     AT25DF* _flash;
     uint32_t _firstFreeAddress;
+    // the files are numbered from the oldest one in the directory, which is in slot _firstFile
+    uint32_t _firstFile;
     uint32_t _numberOfFiles;
-    uint32_t _readPointer;
-    void scanFlash();
+    boolean _fileOpen;
+    // entries are counted as they're written, as the records are different lengths
+    uint32_t _numberOfEntries;
+    uint32_t _fileEntries;
+    // the last entry written, which the next one is encoded against
+    LogEntry _lastEntry;
+    uint8_t _recordsSinceKeyframe;
+    // the channels to log, and the channels in the header of the file that's being written
+    uint8_t _channels;
+    uint8_t _fileChannels;
+    // the same for the time between entries
+    int16_t _interval;
+    int16_t _fileInterval;
+    // the journal slot that the next checkpoint goes in
+    uint32_t _journalSlot;
+    uint32_t _lastCheckpoint;
+    // the end of the last whole record written, which is where checkpoints are taken from
+    JournalRecord _recordEnd;
+    // a checkpoint waiting to be written once the page it covers is in the flash. Its head is
+    // zero if there isn't one.
+    JournalRecord _pendingCheckpoint;
+    // the oldest data in the log, which is only ever past the start in ring mode, and the sector
+    // record at that address
+    uint32_t _tail;
+    JournalRecord _tailSector;
+#ifdef DATASTORE_RING_MODE
+    // the log is erased from the write head up to here. The tail moves on whenever a sector is
+    // erased, and the directory is tidied up afterwards.
+    uint32_t _erasedTo;
+    boolean _tailMoved;
+#endif
+    // set if the flash has data in an old format, which mustn't be written over until it's erased
+    boolean _oldData;
+    // where the current sequential read of the data area has got to, as it has to be restarted when
+    // it wraps around, and the cursor that it's for, if any. A cursor's read carries on from where it
+    // was unless something else has used the flash's sequential read in the meantime.
+    uint32_t _dataReadAddress;
+    DatastoreCursor* _readCursor;
+    // entries are collected in page buffers and written to the flash a page at a time. The
+    // buffers form a queue: _queueHead is the oldest page waiting to be written, and there are
+    // _queueDepth of them. The buffer after those is the one being filled, which holds the bytes
+    // from _bufferAddress up to _firstFreeAddress.
+    uint8_t _pageBuffers[DATASTORE_WRITE_QUEUE_LENGTH][AT25DF_PAGE_SIZE];
+    uint32_t _pageAddresses[DATASTORE_WRITE_QUEUE_LENGTH];
+    uint16_t _pageFills[DATASTORE_WRITE_QUEUE_LENGTH];
+    JournalRecord _pageCheckpoints[DATASTORE_WRITE_QUEUE_LENGTH];
+    uint8_t _queueHead;
+    uint8_t _queueDepth;
+    uint32_t _bufferAddress;
+    uint16_t _bufferFill;
+    uint32_t _nextPollTime;
+    uint32_t _writeStalls;
+    boolean isFull();
+    uint8_t fillBufferIndex();
+    void queueFillBuffer();
+    void writeQueuedPage();
+    void appendRecord(uint8_t* record, uint8_t length);
+    void reserveSpace(uint8_t length);
+    void startSector();
+    boolean isSectorWorkDue();
+    void eraseNextSector();
+    void updateTail();
+    boolean findSectors(JournalRecord* newest);
+    boolean readSectorRecord(uint32_t physicalSectorAddress, JournalRecord* record);
+    uint32_t findEndOfSector(uint32_t sectorAddress);
+    uint8_t encodeEntry(LogEntry* logEntry, uint8_t* record);
+    uint8_t encodeKeyframe(LogEntry* logEntry, uint8_t channels, uint8_t* record);
+    uint8_t encodeSample(LogEntry* logEntry, uint8_t fields, int32_t delta, uint8_t* record);
+    uint8_t encodeHeader(uint8_t channels, uint8_t* record);
+    uint8_t encodeRate(int16_t interval, uint8_t* record);
+    uint8_t frameExtendedRecord(uint8_t tag, uint8_t* record, uint8_t contentsEnd);
+    void decodeRecord(uint8_t* record, LogEntry* logEntry);
+    boolean isEntry(uint8_t tag);
+    boolean isExtended(uint8_t tag);
+    boolean isKeyframe(uint8_t tag);
+    uint32_t physicalAddress(uint32_t address);
+    void startDataRead(uint32_t address);
+    void dataRead(uint8_t* buffer, uint16_t num);
+    void readData(uint32_t address, uint8_t* buffer, uint8_t num);
+    uint32_t bufferedFrom();
+    void readBuffered(uint32_t address, uint8_t* buffer, uint16_t num);
+    uint32_t cursorEnd(DatastoreCursor* cursor);
+    void seekCursor(DatastoreCursor* cursor);
+    uint8_t readRecord(uint8_t* record);
+    uint32_t previousRecordAddress(uint32_t address);
+    uint8_t decodeEntry(uint32_t recordAddress, LogEntry* buffer);
+    void findCheckpoint(uint32_t target, boolean byEntries, JournalRecord* checkpoint);
+    uint32_t scanRecords(uint32_t fromAddress, uint32_t toAddress);
+    void writePadding(uint32_t fromAddress, uint32_t toAddress);
+    uint32_t findEndOfData(uint32_t fromAddress, uint32_t toAddress);
+    uint32_t findFirstErasedPage(uint32_t fromPage, uint32_t lastPage);
+    boolean isPageErased(uint32_t page);
+    uint32_t countUsedRecords(uint32_t baseAddress, uint16_t recordSize, uint32_t maxRecords);
+    boolean eraseMetadataSector(uint32_t address);
+    uint8_t checkByte(uint8_t* data, uint8_t num);
+    void mountDirectory();
+    void dropExpiredFiles();
+    uint32_t fileSlot(uint32_t file);
+    void readFileRecord(uint32_t file, FileRecord* record);
+    boolean isStartValid(FileRecord* record);
+    boolean isEndValid(FileRecord* record);
+    boolean startFile(uint32_t startAddress);
+    void endFile(uint32_t file, uint32_t endAddress, uint32_t numberOfEntries);
+    void writeCheckpoint(JournalRecord* checkpoint);
+    uint8_t checkpointCheck(JournalRecord* record);
+    void readLastCheckpoint(JournalRecord* checkpoint);
+    void makeTestEntry(int i, LogEntry* le);
 };
 
 #endif /*DATASTORE_H*/
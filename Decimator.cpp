@@ -0,0 +1,50 @@
+/*
+    openaltimeter -- an open-source altimeter for RC aircraft
+    Copyright (C) 2010  Jony Hudson
+    http://openaltimeter.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "Decimator.h"
+#include "WProgram.h"
+
+Decimator::Decimator()
+{
+  clear();
+}
+
+void Decimator::add(int32_t pressure)
+{
+  _sum += pressure;
+  _count++;
+}
+
+void Decimator::clear()
+{
+  _sum = 0;
+  _count = 0;
+}
+
+uint16_t Decimator::getCount()
+{
+  return _count;
+}
+
+int32_t Decimator::getAverage()
+{
+  if (_count == 0) return 0;
+  return (_sum + _count / 2) / _count;
+}
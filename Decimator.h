@@ -0,0 +1,43 @@
+/*
+    openaltimeter -- an open-source altimeter for RC aircraft
+    Copyright (C) 2010  Jony Hudson
+    http://openaltimeter.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DECIMATOR_H
+#define DECIMATOR_H
+
+#include "WProgram.h"
+#include "config.h"
+
+// The decimator averages the pressure conversions, which come as fast as the sensor can make them,
+// down to the rate that they're logged at. The sum fits in 32 bits for well over the longest
+// logging interval's worth of conversions.
+class Decimator
+{
+  public:
+    Decimator();
+    void add(int32_t pressure);
+    void clear();
+    uint16_t getCount();
+    // the average of the conversions added since the last clear, or zero if there weren't any
+    int32_t getAverage();
+  private:
+    int32_t _sum;
+    uint16_t _count;
+};
+
+#endif /*DECIMATOR_H*/
@@ -0,0 +1,241 @@
+/*
+    openaltimeter -- an open-source altimeter for RC aircraft
+    Copyright (C) 2010  Jony Hudson
+    http://openaltimeter.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "Download.h"
+#include "WProgram.h"
+#include "SerialOutput.h"
+
+#include <util/crc16.h>
+
+Download::Download(Datastore* datastore) : _encoder(datastore)
+{
+  _datastore = datastore;
+  _mode = DOWNLOAD_IDLE;
+  _reply = 0;
+}
+
+// the whole log, followed by two file end markers.
+void Download::startRaw()
+{
+  _datastore->openCursor(&_cursor);
+  _mode = DOWNLOAD_RAW;
+}
+
+// the entries in the log, as text.
+void Download::startPrint()
+{
+  _datastore->openCursor(&_cursor);
+  _mode = DOWNLOAD_PRINT;
+}
+
+// part of the log, which has to start at a record boundary. It's sent with a header, which is a 'D',
+// then the format version, the log address that the data starts at, the number of entries in it and
+// the number of bytes of data, the last three as 4-byte little-endian numbers. Then comes the data,
+// which starts with a file header and a keyframe if it begins part way through a file.
+void Download::startRange(uint32_t fromAddress, uint32_t toAddress)
+{
+  uint8_t prefix[DATASTORE_MAX_RANGE_PREFIX_SIZE];
+  // the range can be cut down to the part of the log that's there, and the header gives what it was cut down to
+  uint8_t prefixLength = _datastore->openRangeCursor(&_cursor, &fromAddress, toAddress, prefix);
+  uint32_t entries = _datastore->countEntries(fromAddress, _cursor.end);
+  uint32_t length = prefixLength + (_cursor.end - _cursor.address);
+  SerialOut.write('D');
+  SerialOut.write(DATASTORE_FORMAT_VERSION);
+  SerialOut.write((uint8_t*)&fromAddress, sizeof(fromAddress));
+  SerialOut.write((uint8_t*)&entries, sizeof(entries));
+  SerialOut.write((uint8_t*)&length, sizeof(length));
+  SerialOut.write(prefix, prefixLength);
+  _mode = DOWNLOAD_RANGE;
+}
+
+// the raw log from the given address on, in frames. Addresses before the oldest data start at the
+// oldest data, so zero gets the whole log.
+void Download::startFramed(uint32_t fromAddress)
+{
+  _datastore->openCursor(&_cursor);
+  if (fromAddress > _cursor.address) _cursor.address = (fromAddress < _cursor.end) ? fromAddress : _cursor.end;
+  _baseSequence = 0;
+  _nextSequence = 0;
+  _endSent = false;
+  _reply = 0;
+  _lastReplyTime = millis();
+  _retries = 0;
+  _mode = DOWNLOAD_FRAMED;
+}
+
+// the same as the raw download, squeezed down by the log encoder.
+void Download::startCompressed()
+{
+  _datastore->openCursor(&_cursor);
+  _encoder.start();
+  _mode = DOWNLOAD_COMPRESSED;
+}
+
+// sends the next block of a download, or prints the next entry. Nothing more is read from the flash
+// until there's room for it in the output buffer, so that the flash is read while the last block is
+// still going out, and the logging isn't held up waiting for the serial port.
+void Download::service()
+{
+  if (_mode == DOWNLOAD_IDLE) return;
+  if (_mode == DOWNLOAD_FRAMED)
+  {
+    serviceFramed();
+    return;
+  }
+  uint16_t maxBlockSize = DOWNLOAD_BLOCK_SIZE;
+  if (_mode == DOWNLOAD_COMPRESSED)
+  {
+    // the coded data can be bigger than the raw data, so the block is cut down to what's sure to fit
+    // in the output buffer. A byte is kept back for the end code, and there has to be room for the
+    // two file end markers at the end.
+    uint16_t free = SerialOut.getFree();
+    if (free < 1) return;
+    uint16_t maxInput = _encoder.maxInput(free - 1);
+    if (maxInput < 2) return;
+    if (maxInput < maxBlockSize) maxBlockSize = maxInput;
+  }
+  else if (SerialOut.getFree() < DOWNLOAD_BLOCK_SIZE) return;
+  if (_mode == DOWNLOAD_RAW || _mode == DOWNLOAD_RANGE || _mode == DOWNLOAD_COMPRESSED)
+  {
+    uint8_t block[DOWNLOAD_BLOCK_SIZE];
+    uint16_t blockSize = _datastore->readBlock(&_cursor, block, maxBlockSize);
+    if (blockSize > 0)
+    {
+      if (_mode == DOWNLOAD_COMPRESSED) _encoder.encode(block, blockSize);
+      else SerialOut.write(block, blockSize);
+      return;
+    }
+    // a full download ends with two file end markers, and a ranged one has its length in its header
+    if (_mode == DOWNLOAD_RAW) for (int i = 0; i < 2; i++) SerialOut.write(DATASTORE_TAG_FILE_END);
+    if (_mode == DOWNLOAD_COMPRESSED)
+    {
+      uint8_t markers[2] = {DATASTORE_TAG_FILE_END, DATASTORE_TAG_FILE_END};
+      _encoder.encode(markers, 2);
+      _encoder.finish();
+    }
+  }
+  else if (_datastore->entryAvailable(&_cursor))
+  {
+    LogEntry le;
+    if (_datastore->getNextEntry(&_cursor, &le))
+    {
+      le.print();
+      return;
+    }
+  }
+  stop();
+}
+
+void Download::stop()
+{
+  _datastore->closeCursor(&_cursor);
+  _mode = DOWNLOAD_IDLE;
+}
+
+boolean Download::isActive()
+{
+  return (_mode != DOWNLOAD_IDLE);
+}
+
+// while a framed download is going, anything coming in on the serial port is the host's replies,
+// rather than commands.
+boolean Download::isUsingSerialInput()
+{
+  return (_mode == DOWNLOAD_FRAMED);
+}
+
+void Download::serviceFramed()
+{
+  while (Serial.available() > 0)
+  {
+    uint8_t c = Serial.read();
+    if (_reply == 0)
+    {
+      if (c == DOWNLOAD_ABORT)
+      {
+        stop();
+        return;
+      }
+      if (c == DOWNLOAD_ACK || c == DOWNLOAD_NAK) _reply = c;
+    }
+    else
+    {
+      handleReply(_reply, c);
+      _reply = 0;
+      if (_mode == DOWNLOAD_IDLE) return;
+    }
+  }
+  if (!_endSent && (uint8_t)(_nextSequence - _baseSequence) < DOWNLOAD_WINDOW)
+  {
+    if (SerialOut.getFree() >= DOWNLOAD_FRAME_HEADER_SIZE + DOWNLOAD_BLOCK_SIZE + DOWNLOAD_FRAME_CRC_SIZE) sendFrame();
+  }
+  else if (millis() - _lastReplyTime > DOWNLOAD_ACK_TIMEOUT_MS)
+  {
+    if (++_retries > DOWNLOAD_MAX_RETRIES) stop();
+    else resend();
+  }
+}
+
+// an acknowledgement moves the window on past the given frame. A NAK does the same for the frames
+// before the given one, and then they're sent again from there. Replies for frames that haven't
+// been sent, or have already been acknowledged, are ignored.
+void Download::handleReply(uint8_t reply, uint8_t sequence)
+{
+  uint8_t outstanding = _nextSequence - _baseSequence;
+  uint8_t acknowledged = sequence - _baseSequence;
+  if (reply == DOWNLOAD_ACK) acknowledged++;
+  if (acknowledged > outstanding) return;
+  _lastReplyTime = millis();
+  _retries = 0;
+  _baseSequence += acknowledged;
+  if (_endSent && _baseSequence == _nextSequence) stop();
+  else if (reply == DOWNLOAD_NAK) resend();
+}
+
+void Download::sendFrame()
+{
+  uint8_t frame[DOWNLOAD_FRAME_HEADER_SIZE + DOWNLOAD_BLOCK_SIZE + DOWNLOAD_FRAME_CRC_SIZE];
+  uint8_t length = _datastore->readBlock(&_cursor, frame + DOWNLOAD_FRAME_HEADER_SIZE, DOWNLOAD_BLOCK_SIZE);
+  // the read might have skipped on to the tail first, so the frame starts wherever the data came from
+  uint32_t address = _cursor.address - length;
+  _frameAddresses[_nextSequence % DOWNLOAD_WINDOW] = address;
+  frame[0] = DOWNLOAD_FRAME_START;
+  frame[1] = _nextSequence++;
+  frame[2] = length;
+  memcpy(frame + 3, &address, sizeof(address));
+  uint16_t crc = 0;
+  for (uint8_t i = 1; i < DOWNLOAD_FRAME_HEADER_SIZE + length; i++) crc = _crc_xmodem_update(crc, frame[i]);
+  frame[DOWNLOAD_FRAME_HEADER_SIZE + length] = lowByte(crc);
+  frame[DOWNLOAD_FRAME_HEADER_SIZE + length + 1] = highByte(crc);
+  SerialOut.write(frame, DOWNLOAD_FRAME_HEADER_SIZE + length + DOWNLOAD_FRAME_CRC_SIZE);
+  if (length == 0) _endSent = true;
+  // the timeout runs from the last frame sent, as well as the last reply
+  _lastReplyTime = millis();
+}
+
+// goes back to the oldest frame that hasn't been acknowledged. If they all have been, the cursor is
+// already where the next frame starts.
+void Download::resend()
+{
+  if (_nextSequence != _baseSequence) _cursor.address = _frameAddresses[_baseSequence % DOWNLOAD_WINDOW];
+  _nextSequence = _baseSequence;
+  _endSent = false;
+  _lastReplyTime = millis();
+}
@@ -0,0 +1,95 @@
+/*
+    openaltimeter -- an open-source altimeter for RC aircraft
+    Copyright (C) 2010  Jony Hudson
+    http://openaltimeter.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DOWNLOAD_H
+#define DOWNLOAD_H
+
+#include "WProgram.h"
+#include "config.h"
+
+#include "Datastore.h"
+#include "LogEncoder.h"
+
+// -- framed download
+// The framed download sends the log in numbered frames, each checked with a CRC, which the host
+// acknowledges. A frame is:
+//   DOWNLOAD_FRAME_START, the sequence number, the number of data bytes, the log address of the
+//   data (4 bytes, little-endian), the data, and then a CRC16 of everything after the start byte,
+//   low byte first. The CRC is the XMODEM one: polynomial 0x1021, starting from zero.
+// A frame with no data is the end of the download. The host answers each good frame with
+// DOWNLOAD_ACK and its sequence number, which acknowledges that frame and all the ones before it.
+// Up to DOWNLOAD_WINDOW frames are sent ahead of the acknowledgements. If a frame is bad, or out of
+// order, the host answers with DOWNLOAD_NAK and the sequence number that it was expecting, and the
+// frames are sent again from there. If nothing is heard for DOWNLOAD_ACK_TIMEOUT_MS then the frames
+// that haven't been acknowledged are sent again, and after DOWNLOAD_MAX_RETRIES of these the
+// download is given up. The host can stop the download with DOWNLOAD_ABORT. A download that was
+// broken off can be picked up again by asking for the log from the address after the last good frame.
+#define DOWNLOAD_FRAME_START 0xa5
+#define DOWNLOAD_FRAME_HEADER_SIZE 7
+#define DOWNLOAD_FRAME_CRC_SIZE 2
+#define DOWNLOAD_ACK 'K'
+#define DOWNLOAD_NAK 'N'
+#define DOWNLOAD_ABORT 'X'
+
+// what's being sent
+#define DOWNLOAD_IDLE 0
+#define DOWNLOAD_RAW 1
+#define DOWNLOAD_PRINT 2
+#define DOWNLOAD_RANGE 3
+#define DOWNLOAD_FRAMED 4
+#define DOWNLOAD_COMPRESSED 5
+
+// Downloads go on a bit at a time, with service() called each time around the main loop, so that
+// logging can carry on while the log is being sent.
+class Download
+{
+  public:
+    Download(Datastore* datastore);
+    void startRaw();
+    void startPrint();
+    void startRange(uint32_t fromAddress, uint32_t toAddress);
+    void startFramed(uint32_t fromAddress);
+    void startCompressed();
+    void service();
+    void stop();
+    boolean isActive();
+    boolean isUsingSerialInput();
+  private:
+    Datastore* _datastore;
+    DatastoreCursor _cursor;
+    uint8_t _mode;
+    LogEncoder _encoder;
+    // the framed download's window: the oldest frame that hasn't been acknowledged, and the next frame
+    // to send. The frames can be short, or skip over data that's been overwritten, so the address that
+    // each one started at is kept, by its sequence number, for sending them again.
+    uint8_t _baseSequence;
+    uint8_t _nextSequence;
+    uint32_t _frameAddresses[DOWNLOAD_WINDOW];
+    boolean _endSent;
+    // a reply from the host that's waiting for its sequence number
+    uint8_t _reply;
+    uint32_t _lastReplyTime;
+    uint8_t _retries;
+    void serviceFramed();
+    void handleReply(uint8_t reply, uint8_t sequence);
+    void sendFrame();
+    void resend();
+};
+
+#endif /*DOWNLOAD_H*/
@@ -23,8 +23,14 @@
 #include "Beeper.h"
 #include "BMP085.h"
 #include "Datastore.h"
+#include "Download.h"
 #include "Messages.h"
+#include "ClimbFilter.h"
+#include "Decimator.h"
+#include "PressureHistory.h"
+#include "PretriggerBuffer.h"
 #include "Radio.h"
+#include "SerialOutput.h"
 #include "Settings.h"
 #include "SPI.h"
 #include <Wire.h>
@@ -33,8 +39,9 @@
 // hardware objects
 BMP085 pressureSensor(BMP085_XCLR_PIN, BMP085_EOC_PIN, BMP085_STANDARD);
 Battery battery(BATTERY_ANALOG_PIN);
-AT25DF flash(AT25DF_SS_PIN);
+AT25DF flash;
 Datastore datastore(&flash);
+Download download(&datastore);
 Radio radio(RADIO_INPUT_PIN);
 Radio servo(SERVO_INPUT_PIN);
 
@@ -42,7 +49,26 @@ Radio servo(SERVO_INPUT_PIN);
 boolean logging = true;
 boolean lowVoltageAlarm = false;
 boolean lostModelAlarm = false;
+// when the next tick is due, the time of the last one, and the time of the last entry that was stored
 uint32_t millisCounter;
+uint32_t lastTickTime;
+uint32_t lastStoredTime;
+// whether every tick is being logged, after a launch, and until when
+boolean highRate = false;
+uint32_t highRateEndTime = 0;
+// the recent pressure samples, which the height detectors look back over
+PressureHistory pressureHistory;
+ClimbFilter climbFilter;
+// averages the pressure conversions down to the ticks, and the ticks down to the logging rate
+Decimator decimator;
+Decimator slowDecimator;
+// the ticks from just before now, kept on the ground in case there's a launch
+PretriggerBuffer pretriggerBuffer;
+// the serial rate, which is only raised for downloads, when it was raised, and whether a download has
+// started since
+uint32_t baudRate = SERIAL_BAUD_RATE;
+uint32_t baudRateChangeTime;
+boolean baudRateUsed;
 
 // the settings structure - this is loaded from non-volatile memory when the logger starts up
 Settings settings;
@@ -61,6 +87,8 @@ void setup()
   // set up all the hardware
   analogReference(EXTERNAL);
   Wire.begin();
+  // Wire.begin() sets the bus up for 100kHz
+  TWBR = ((F_CPU / I2C_CLOCK_HZ) - 16) / 2;
   Serial.begin(SERIAL_BAUD_RATE);
   // enable the pull-up resistor on the serial input, to stop noise being read as characters
   digitalWrite(0, HIGH);
@@ -68,8 +96,8 @@ void setup()
   // This is useful when debugging, as it can get difficult to remember which
   // version of the firmware is on a particular board.
   printMessage(WELCOME_MESSAGE);
-  Serial.print("Build: ");
-  Serial.println(__TIMESTAMP__);
+  printMessage(BUILD_MESSAGE);
+  SerialOut.println(__TIMESTAMP__);
   printMessage(DATA_FORMAT_MESSAGE);
   printMessage(SETTINGS_FORMAT_MESSAGE);
   SettingsStore::load(&settings);
@@ -81,12 +109,20 @@ void setup()
   flash.setup();
   Beeper::setup(BEEPER_PIN);
   printMessage(DATASTORE_SETUP_MESSAGE);
+  uint32_t mountStartTime = millis();
   datastore.setup();
+  setLogChannels();
+  uint32_t mountTime = millis() - mountStartTime;
   printMessage(DONE_MESSAGE);
+  printMessage(DATASTORE_MOUNT_TIME_MESSAGE);
+  SerialOut.println(mountTime);
   printMessage(ALTIMETER_BASE_PRESSURE_MESSAGE);
   pressureSensor.setBasePressure();
-  Serial.print(pressureSensor.getBasePressure());
-  Serial.print(" ");
+  resetHeightMonitor();
+  pressureSensor.setTemperatureInterval(ALTIMETER_TEMPERATURE_INTERVAL_MS);
+  pressureSensor.setClimbFilter(&climbFilter);
+  SerialOut.print(pressureSensor.getBasePressure());
+  SerialOut.print(" ");
   printMessage(DONE_MESSAGE);
   Beeper::playTune(startupTune);
   Beeper::waitForTuneToEnd();
@@ -94,21 +130,31 @@ void setup()
   if (settings.batteryType == BATTERY_TYPE_LIPO)
   {
     printMessage(LIPO_CELLS_MESSAGE);
-    Serial.print(battery.numberOfCells());
-    Serial.println(".");
+    SerialOut.print(battery.numberOfCells());
+    SerialOut.println(".");
     Beeper::outputInteger(battery.numberOfCells());
   }
   // take note of when we're starting the loop, which we'll use for our periodic logging
-  millisCounter = millis();
+  lastStoredTime = millis();
+  lastTickTime = lastStoredTime;
+  millisCounter = lastStoredTime + LOG_HIGH_RATE_INTERVAL_MS;
 }
 
 // we run around this loop as fast as we can, each time doing several things:
 // - check for commands from the radio input
 // - check whether there's a hardware condition which would change our state
-// - check whether it's time to write another entry to the log.
+// - keep the pressure sensor converting, and log the average of its conversions when it's time
 // - check if there's a serial command which would change our state
+// - write out any log data that's waiting for the flash
+// - send the next part of the log, if it's being downloaded
+// - put the serial rate back, if it was raised for a download that's finished
 void loop()
 {
+  // -- move any pending flash writes along
+  datastore.service();
+  // -- move any download along
+  download.service();
+  SerialOut.service();
   // -- handle radio commands
   // we only handle the radio commands if the low battery alarm is not sounding.
   if (!lowVoltageAlarm)
@@ -117,16 +163,33 @@ void loop()
     if (radioState == RADIO_SWITCH_MID) handleRadioCommand(settings.midPositionAction);
     if (radioState == RADIO_SWITCH_ON) handleRadioCommand(settings.onPositionAction);
   }
-  // -- update the log if needed
-  if (millis() > millisCounter) 
+  // -- update the log if needed. While logging, the pressure sensor is read in the background one
+  // conversion after another, as fast as it can go, and every conversion goes to the decimator. Every
+  // LOG_HIGH_RATE_INTERVAL_MS the conversions since the last tick are averaged, and logTick() decides
+  // what to log.
+  if (logging && !pressureSensor.isSampling()) pressureSensor.startOversample(ALTIMETER_OST, 1);
+  if (pressureSensor.service()) decimator.add(pressureSensor.pressure);
+  if (climbFilter.hasNewEstimate()) updateHeightMonitor();
+  if (logging && (int32_t)(millis() - millisCounter) >= 0 && decimator.getCount() > 0)
   {
-    millisCounter += settings.logIntervalMS;
-    log();
+    logTick(millisCounter);
+    millisCounter += LOG_HIGH_RATE_INTERVAL_MS;
+    // if the logging has got behind, the ticks that were missed are skipped rather than caught up. They
+    // stay on the same grid, so the gap is still timed correctly in the log, but the pre-trigger buffer
+    // has to start again, as its ticks are timed by their place in it.
+    int32_t behind = (int32_t)(millis() - millisCounter);
+    if (behind >= 0)
+    {
+      millisCounter += (behind / LOG_HIGH_RATE_INTERVAL_MS + 1) * LOG_HIGH_RATE_INTERVAL_MS;
+      pretriggerBuffer.clear();
+    }
   }
   // -- check for hardware conditions
   checkBatteryVoltage();
-  // -- check for serial commands
-  if (Serial.available() > 0) parseCommand(Serial.read());
+  // -- check for serial commands. A framed download takes the host's replies itself.
+  if (!download.isUsingSerialInput() && Serial.available() > 0) parseCommand(Serial.read());
+  // -- go back to the normal serial rate when we can
+  if (baudRate != SERIAL_BAUD_RATE) serviceBaudRate();
 }
 
 void handleRadioCommand(Action act)
@@ -173,6 +236,18 @@ void parseCommand(uint8_t comm)
     case 'd':
       downloadData();
       break;
+    case 'D':
+      downloadRange();
+      break;
+    case 'B':
+      downloadFramed();
+      break;
+    case 'z':
+      downloadCompressed();
+      break;
+    case 'S':
+      changeBaudRate();
+      break;
     case 'p':
       printData();
       break;
@@ -208,32 +283,34 @@ void parseCommand(uint8_t comm)
     case 'u':
       uploadLogEntry();
       break;
+    case 'q':
+      printWriteQueueStatus();
+      break;
   }
 }
 
-// this function that is called periodically to log the pressure etc
-void log()
+// fills in a log entry with the given pressure and the current values of the other channels.
+void makeLogEntry(LogEntry* le, int32_t pressure)
 {
-  if (logging)
-  {
-    LogEntry le;
-    pressureSensor.softOversample(ALTIMETER_OST, ALTIMETER_OSP);
-    le.setPressure(pressureSensor.pressure);
-    le.setTemperature(pressureSensor.temperature);
-    le.setBattery(battery.readVoltage());
-    if (settings.logServo) le.setServo(servo.getServoValueQuick());
-    else le.setServo(0);
-    addLogEntry(&le);
-  }
+  le->setPressure(pressure);
+  le->setTemperature(pressureSensor.temperature);
+  le->setBattery(battery.readVoltage());
+  if (settings.logServo) le->setServo(servo.getServoValueQuick());
+  else le->setServo(0);
 }
+
 // this part of the function is broken out to support data upload/flight simulation.
 void addLogEntry(LogEntry* le)
 {
-  // update the height related quantities
-  updateHeightMonitor(le);
-  // store the entry
+  // the height monitor doesn't run here: it runs on the climb filter, which is fed by every pressure
+  // conversion. The detectors look back over the history for the ground level.
+  pressureHistory.add(le->getPressure());
+  // store the entry. The progress dots would get mixed up with the data if the log is being
+  // downloaded, and they're left out if the output is backed up, rather than waiting.
   if (datastore.addEntry(le))
-  Serial.print(".");
+  {
+    if (!download.isActive() && SerialOut.getFree() > 0) SerialOut.print(".");
+  }
   else
   {
     printMessage(FLASH_FULL_MESSAGE);
@@ -242,68 +319,96 @@ void addLogEntry(LogEntry* le)
 }
 
 // these functions track various height-related quantities. They implement the launch detectors, max height detector etc.
-float currentHeight = 0;
-float maxHeight = 0;                    // The overall maximum height of the flight.
-void updateHeightMonitor(LogEntry* le)
+// They work in pressure, which goes down as the height goes up, so that no sample has to be converted to a height:
+// only the heights that are read out are converted, with heightOf(). They run on the climb filter's estimates, which
+// come with every pressure conversion, so they see the flight in much more detail than the log does.
+int32_t currentPressure = 0;
+int32_t maxHeightPressure = 0;          // The pressure at the overall maximum height of the flight.
+void updateHeightMonitor()
 {
-  currentHeight = pressureSensor.convertToAltitude(le->getPressure(), settings.heightUnits);
-  if (currentHeight > maxHeight) maxHeight = currentHeight;
+  currentPressure = climbFilter.getPressure();
+  if (currentPressure < maxHeightPressure) maxHeightPressure = currentPressure;
   updateDLGHeightMonitor();
 }
 
+// the height of the given pressure above the base pressure, in the user's units.
+int32_t heightOf(int32_t pressure)
+{
+  return (int32_t)pressureSensor.convertToAltitude(pressure, settings.heightUnits);
+}
+
 // DLG specific height functions and variables. This is broken out from the main height monitor to make the firmware
 // easier to customise.
-uint8_t launchCount = 0;                  // A launch is defined as N successive periods with more than a certain climb rate.
-                                          // This keeps track of how long we've been climbing.
-uint8_t launchWindowCount = 0;            // Used to track launch height separate from max height.
-float lastHeight = 0;                  // Used for measuring climb rates.
+boolean climbing = false;                 // A launch is defined as climbing at more than a certain rate for a certain time.
+uint32_t climbStartTime = 0;              // This keeps track of how long we've been climbing.
+boolean inLaunchWindow = false;           // Used to track launch height separate from max height.
+uint32_t launchWindowEndTime = 0;
 boolean launched = false;                 // This indicates whether we're in flight or not. Launch detector is disabled in flight.
-float maxLaunchHeight = 0;
-float launchWindowEndHeight = 0;       // It's useful to know what height was attained a few seconds after launch to optimise push over.
+int32_t maxLaunchHeightPressure = 0;
+int32_t launchWindowEndPressure = 0;      // It's useful to know what height was attained a few seconds after launch to optimise push over.
+// The detector's thresholds in pressure. They're worked out at the base pressure, where launches start, whenever it
+// changes. The height units don't come into them, as the old height thresholds were scaled by the units too.
+int32_t launchClimbRate = 0;              // The climb rate of LAUNCH_CLIMB_RATE, in Pa/s.
+int32_t rearmPressure = 0;                // The pressure at LAUNCH_DETECTOR_REARM_HEIGHT.
+void setLaunchThresholds()
+{
+  launchClimbRate = pressureSensor.getBasePressure() - pressureSensor.convertToPressure(LAUNCH_CLIMB_RATE);
+  rearmPressure = pressureSensor.convertToPressure(LAUNCH_DETECTOR_REARM_HEIGHT);
+}
+
+// puts all of the heights at ground level, which is the base pressure. This must be called when the base
+// pressure is first set.
+void resetHeightMonitor()
+{
+  currentPressure = pressureSensor.getBasePressure();
+  maxHeightPressure = currentPressure;
+  maxLaunchHeightPressure = currentPressure;
+  launchWindowEndPressure = currentPressure;
+  setLaunchThresholds();
+}
+
 void updateDLGHeightMonitor()
 {
-  // We monitor the height data looking for a "launch". This is a number of samples that climb consistently at greater than a given rate.
+  uint32_t now = climbFilter.getTime();
+  // We monitor the climb rate looking for a "launch". This is a climb at greater than a given rate that lasts for a given time.
   if (!launched)
   {
-    if (currentHeight - lastHeight > LAUNCH_CLIMB_THRESHOLD * settings.heightUnits) {
-      launchCount++;
+    if (climbFilter.getClimbRate() > launchClimbRate) {
+      if (!climbing) climbStartTime = now;
+      climbing = true;
       // these lines can be very helpful when debugging the launch detector!
-//      Serial.print("Delt: ");Serial.print(LAUNCH_CLIMB_THRESHOLD * settings.heightUnits);Serial.print("\n");
-//      Serial.print("Curr: ");Serial.print(currentHeight);Serial.print("\n");
-//      Serial.print("Last: ");Serial.print(lastHeight);Serial.print("\n");
-//      Serial.print("Launch count: ");Serial.print(launchCount, DEC);Serial.print("\n");
+//      SerialOut.print("Rate: ");SerialOut.print(launchClimbRate);SerialOut.print("\n");
+//      SerialOut.print("Curr: ");SerialOut.print(climbFilter.getClimbRate());SerialOut.print("\n");
+//      SerialOut.print("Climbing for: ");SerialOut.print(now - climbStartTime);SerialOut.print("\n");
     }
-    else launchCount = 0;
-    lastHeight = currentHeight;
-    if (launchCount >= (LAUNCH_CLIMB_TIME / settings.logIntervalMS))
+    else climbing = false;
+    if (climbing && now - climbStartTime >= LAUNCH_CLIMB_TIME)
     {
       // we've just detected a launch - disable the launch detector
       launched = true;
-      launchCount = 0;
+      climbing = false;
       // When we detect a launch we do a few things: we reset the base pressure to the highest pressure in the few seconds before the launch;
-      // we start a countdown which defines the "launch window"; we reset the maximum heights.
+      // we log the launch in detail; we start a countdown which defines the "launch window"; we reset the maximum heights.
       // -- reset base pressure
-      uint32_t newBasePressure = 0;
-      datastore.startReverseRead();
-      for (int i = LAUNCH_SEEKBACK_SAMPLES; i > 0; i--)
+      // the history is cleared at file boundaries, so this won't look back into the previous file. It can be
+      // empty, just after starting up or in a replay, and then the base pressure is left as it is.
+      uint32_t newBasePressure = pressureSensor.getBasePressure();
+      if (pressureHistory.getNumberOfSamples() > 0)
       {
-        if (datastore.entryReverseAvailable())
-        {
-          LogEntry le;
-          datastore.getPreviousEntry(&le);
-          // we stop if we encounter a file boundary.
-          // unlikely to happen, but worth checking for.
-          if (le.isFileEndMarker()) break;
-          if (le.getPressure() > newBasePressure) newBasePressure = le.getPressure();
-        }      
+        newBasePressure = pressureHistory.getMax(LAUNCH_SEEKBACK_SAMPLES);
+        pressureSensor.setBasePressure(newBasePressure);
+        setLaunchThresholds();
       }
-      pressureSensor.setBasePressure(newBasePressure);
+      // -- log the launch. The ticks from before it are stored first, so that the event comes after them.
+      startHighRate();
+      datastore.addEvent(DATASTORE_EVENT_LAUNCH);
       // -- time the launch window
-      launchWindowCount = (LAUNCH_WINDOW_TIME / settings.logIntervalMS) + 1;
+      inLaunchWindow = true;
+      launchWindowEndTime = now + LAUNCH_WINDOW_TIME;
       // -- reset max heights
-      maxHeight = currentHeight;
-      maxLaunchHeight = currentHeight;
-      launchWindowEndHeight = 0;
+      maxHeightPressure = currentPressure;
+      maxLaunchHeightPressure = currentPressure;
+      launchWindowEndPressure = newBasePressure;
     }
   }
   else
@@ -312,16 +417,75 @@ void updateDLGHeightMonitor()
     // below a certain threshold, or a height output function being commanded by the user (on the basis that this should always happen on the
     // ground - the latter is implemented to stop the logger getting stuck should the ground-level pressure change dramatically during a flight.)
     // Here we check for the former.
-    if (currentHeight < LAUNCH_DETECTOR_REARM_HEIGHT * settings.heightUnits) launched = false;
+    if (currentPressure > rearmPressure) launched = false;
   }
   // if we're in the launch window we need to track the maximum altitude.
-  if (launchWindowCount > 0)
+  if (inLaunchWindow)
   {
-    if (currentHeight > maxLaunchHeight) maxLaunchHeight = currentHeight;
+    if (currentPressure < maxLaunchHeightPressure) maxLaunchHeightPressure = currentPressure;
     // if this is the end of the launch window then we record the height
-    if (launchWindowCount == 1) launchWindowEndHeight = currentHeight;
-    launchWindowCount--;
+    if ((int32_t)(now - launchWindowEndTime) >= 0)
+    {
+      launchWindowEndPressure = currentPressure;
+      inLaunchWindow = false;
+    }
+  }
+}
+
+// The adaptive log rate. Every tick is logged for a while after a launch. Otherwise the ticks are averaged
+// down, to the logging interval in flight and to LOG_GROUND_INTERVAL_MS on the ground, where little happens
+// between flights. On the ground the ticks are kept in the pre-trigger buffer as well, and when there's a
+// launch they're stored at the high rate, going back over the time that the slow entries had covered. Every
+// entry is stored with its time from the one before, so the downloader can put them back in order.
+void logTick(uint32_t tickTime)
+{
+  LogEntry le;
+  makeLogEntry(&le, decimator.getAverage());
+  decimator.clear();
+  lastTickTime = tickTime;
+  if (highRate && (int32_t)(tickTime - highRateEndTime) >= 0) highRate = false;
+  if (highRate)
+  {
+    storeEntry(&le, tickTime);
+    return;
+  }
+  boolean onGround = !launched && currentPressure > rearmPressure;
+  if (onGround) pretriggerBuffer.add(&le);
+  else pretriggerBuffer.clear();
+  slowDecimator.add(le.getPressure());
+  uint16_t intervalMS = onGround ? LOG_GROUND_INTERVAL_MS : settings.logIntervalMS;
+  if (tickTime - lastStoredTime >= intervalMS)
+  {
+    le.setPressure(slowDecimator.getAverage());
+    slowDecimator.clear();
+    storeEntry(&le, tickTime);
+  }
+}
+
+// stores an entry for the given tick, along with its time from the last entry stored.
+void storeEntry(LogEntry* le, uint32_t time)
+{
+  int32_t intervalMS = constrain((int32_t)(time - lastStoredTime), -32768L, 32767L);
+  datastore.setInterval((int16_t)intervalMS);
+  lastStoredTime = time;
+  addLogEntry(le);
+}
+
+// flushes the pre-trigger buffer into the log, oldest first, and logs every tick for LOG_HIGH_RATE_TIME from now.
+void startHighRate()
+{
+  if (!logging) return;
+  LogEntry le;
+  // the flash can fill up part way through, which stops the logging
+  for (int8_t age = pretriggerBuffer.getNumberOfEntries() - 1; age >= 0 && logging; age--)
+  {
+    pretriggerBuffer.getEntry(age, &le);
+    storeEntry(&le, lastTickTime - (uint32_t)age * LOG_HIGH_RATE_INTERVAL_MS);
   }
+  pretriggerBuffer.clear();
+  slowDecimator.clear();
+  highRate = true;
+  highRateEndTime = lastTickTime + LOG_HIGH_RATE_TIME;
 }
   
 
@@ -334,9 +498,14 @@ void checkBatteryVoltage()
 void erase()
 {
   stopLogging();
+  download.stop();
   printMessage(ERASING_MESSAGE);
+  uint32_t eraseStartTime = millis();
   datastore.erase();
+  uint32_t eraseTime = millis() - eraseStartTime;
   printMessage(DONE_MESSAGE);
+  printMessage(ERASE_TIME_MESSAGE);
+  SerialOut.println(eraseTime);
 }
 
 void stopLogging()
@@ -344,6 +513,7 @@ void stopLogging()
   if (logging)
   {
     logging = false;
+    datastore.flush();
     printMessage(LOGGING_DISABLED_MESSAGE);
   }
 }
@@ -352,7 +522,12 @@ void startLogging()
 {
   if (!logging)
   {
-    millisCounter = millis();
+    decimator.clear();
+    slowDecimator.clear();
+    pretriggerBuffer.clear();
+    lastStoredTime = millis();
+    lastTickTime = lastStoredTime;
+    millisCounter = lastStoredTime + LOG_HIGH_RATE_INTERVAL_MS;
     logging = true;
     printMessage(LOGGING_ENABLED_MESSAGE);
   }
@@ -360,40 +535,157 @@ void startLogging()
 
 void getFileInfo()
 {
-  stopLogging();
   printMessage(NUM_FILES_MESSAGE);
-  Serial.println(datastore.getNumberOfFiles());
+  SerialOut.println(datastore.getNumberOfFiles());
   printMessage(NUM_ENTRIES_MESSAGE);
-  Serial.println(datastore.getNumberOfEntries());
+  SerialOut.println(datastore.getNumberOfEntries());
   printMessage(MAX_ENTRIES_MESSAGE);
-  Serial.println(DATASTORE_MAX_ENTRIES);
+  SerialOut.println(DATASTORE_MAX_ENTRIES);
 }
 
+// we transmit all of the data that's in the log when the download starts, followed by two file end
+// markers. There's no checksum - downloadFramed() should be used where that matters.
 void downloadData()
 {
-  // we transmit all of the data, followed by two blank records, TODO: followed by a checksum
-  LogEntry le;
-  stopLogging();
-  datastore.startRead();
-  while( datastore.entryAvailable() )
+  download.startRaw();
+}
+
+void printWriteQueueStatus()
+{
+  printMessage(WRITE_QUEUE_DEPTH_MESSAGE);
+  SerialOut.println((int)datastore.getWriteQueueDepth());
+  printMessage(WRITE_STALLS_MESSAGE);
+  SerialOut.println(datastore.getWriteStalls());
+  printMessage(SERIAL_STALLS_MESSAGE);
+  SerialOut.println(SerialOut.getStalls());
+}
+
+// The ranged download command is a 'D', then a byte saying what to download, then its arguments,
+// which are 4-byte little-endian numbers:
+// - 'f' file: one file
+// - 'r' first entry, number of entries: a range of entries, numbered from the oldest in the log
+// - 'e' entry: everything from the given entry on
+// - 'a' address: everything from the given log address on, like the end of the last download
+// The reply is described in Download::startRange(). Only the data that's asked for is read from
+// the flash.
+void downloadRange()
+{
+  uint8_t kind;
+  uint32_t arguments[2];
+  if (!readSerialBytes(&kind, 1)) return;
+  uint8_t numberOfArguments = (kind == 'r') ? 2 : 1;
+  if (!readSerialBytes((uint8_t*)arguments, numberOfArguments * sizeof(uint32_t))) return;
+  uint32_t head = datastore.getHead();
+  uint32_t start = head;
+  uint32_t end = head;
+  switch (kind)
   {
-    datastore.getNextEntry(&le);
-    Serial.write((byte*)&le, DATASTORE_LOG_ENTRY_SIZE);
+    case 'f':
+      if (arguments[0] >= datastore.getNumberOfFiles()) break;
+      start = datastore.getFileStartAddress(arguments[0]);
+      // a file that's been ended finishes with its end marker, which is sent with it
+      end = datastore.getFileEndAddress(arguments[0]);
+      if (end < head) end++;
+      break;
+    case 'r':
+      start = datastore.findEntry(arguments[0]);
+      end = datastore.skipEntries(start, arguments[1]);
+      break;
+    case 'e':
+      start = datastore.findEntry(arguments[0]);
+      break;
+    case 'a':
+      start = datastore.findRecord(arguments[0]);
+      break;
+    default:
+      return;
   }
-  // write the two blank entries
-  for (int i = 0; i < 2 * DATASTORE_LOG_ENTRY_SIZE; i++) Serial.write(0xff);
+  download.startRange(start, end);
 }
 
-void printData()
+// The framed download command is a 'B' and then the log address to start from, as a 4-byte
+// little-endian number, which is zero for the whole log. The protocol is described in Download.h.
+void downloadFramed()
 {
-  LogEntry le;
-  stopLogging();
-  datastore.startRead();
-  while( datastore.entryAvailable() )
+  uint32_t fromAddress;
+  if (!readSerialBytes((uint8_t*)&fromAddress, sizeof(fromAddress))) return;
+  download.startFramed(fromAddress);
+}
+
+// The baud rate command is an 'S' and then the rate to change to, as a 4-byte little-endian number.
+// The reply is an 'S' and the rate that will be used, which is SERIAL_BAUD_RATE if the one asked for
+// isn't one of SERIAL_FAST_BAUD_RATES. Then both ends change to the new rate, and the host sends
+// SERIAL_BAUD_CHECK, which is sent back to it. If the check doesn't come through, then we go back to
+// SERIAL_BAUD_RATE. The new rate only lasts until the next download has finished, or until
+// SERIAL_BAUD_IDLE_TIMEOUT_MS has gone by without one starting, so a client that doesn't know about
+// this always finds us at SERIAL_BAUD_RATE.
+void changeBaudRate()
+{
+  uint32_t rate;
+  if (!readSerialBytes((uint8_t*)&rate, sizeof(rate))) return;
+  if (!isFastBaudRate(rate)) rate = SERIAL_BAUD_RATE;
+  SerialOut.write('S');
+  SerialOut.write((uint8_t*)&rate, sizeof(rate));
+  if (rate == SERIAL_BAUD_RATE) return;
+  setBaudRate(rate);
+  uint8_t check[] = SERIAL_BAUD_CHECK;
+  uint8_t received[sizeof(check)];
+  if (!readSerialBytes(received, sizeof(received)) || memcmp(received, check, sizeof(check)) != 0)
+  {
+    setBaudRate(SERIAL_BAUD_RATE);
+    return;
+  }
+  SerialOut.write(check, sizeof(check));
+  baudRateChangeTime = millis();
+  baudRateUsed = false;
+}
+
+boolean isFastBaudRate(uint32_t rate)
+{
+  uint32_t rates[] = SERIAL_FAST_BAUD_RATES;
+  for (uint8_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) if (rate == rates[i]) return true;
+  return false;
+}
+
+void setBaudRate(uint32_t rate)
+{
+  // the last bytes have to go out at the old rate, and starting the UART again stops the output
+  // interrupt
+  SerialOut.waitUntilSent();
+  Serial.begin(rate);
+  // anything that came in while the rates didn't match is junk
+  Serial.flush();
+  baudRate = rate;
+}
+
+void serviceBaudRate()
+{
+  if (download.isActive()) baudRateUsed = true;
+  else if (baudRateUsed || millis() - baudRateChangeTime > SERIAL_BAUD_IDLE_TIMEOUT_MS) setBaudRate(SERIAL_BAUD_RATE);
+}
+
+// reads bytes for a binary command, giving up if they don't all come in time.
+boolean readSerialBytes(uint8_t* buffer, uint8_t num)
+{
+  uint32_t startTime = millis();
+  for (uint8_t i = 0; i < num; i++)
   {
-    datastore.getNextEntry(&le);
-    le.print();
+    while (Serial.available() == 0) if (millis() - startTime > SERIAL_COMMAND_TIMEOUT_MS) return false;
+    buffer[i] = Serial.read();
   }
+  return true;
+}
+
+// the compressed download gives the same data as downloadData(), coded as described in LogEncoder.h.
+// A typical day's flying comes out at a little over half the size.
+void downloadCompressed()
+{
+  download.startCompressed();
+}
+
+void printData()
+{
+  download.startPrint();
 }
 
 void outputValue(int32_t h, char message)
@@ -409,17 +701,17 @@ void outputValue(int32_t h, char message)
 
 void outputMaxHeight()
 {
-  outputValue((int32_t)maxHeight, OUTPUT_MAX_HEIGHT_MESSAGE);
+  outputValue(heightOf(maxHeightPressure), OUTPUT_MAX_HEIGHT_MESSAGE);
 }
 
 void outputMaxLaunchHeight()
 {
-  outputValue((int32_t)maxLaunchHeight, OUTPUT_MAX_LAUNCH_HEIGHT_MESSAGE);
+  outputValue(heightOf(maxLaunchHeightPressure), OUTPUT_MAX_LAUNCH_HEIGHT_MESSAGE);
 }
 
 void outputLaunchWindowEndHeight()
 {
-  outputValue((int32_t)launchWindowEndHeight, OUTPUT_LAUNCH_WINDOW_END_HEIGHT_MESSAGE);
+  outputValue(heightOf(launchWindowEndPressure), OUTPUT_LAUNCH_WINDOW_END_HEIGHT_MESSAGE);
 }
 
 void outputHeights()
@@ -444,6 +736,7 @@ void soundLowVoltageAlarm()
   {
     printMessage(START_LVA_MESSAGE);
     lowVoltageAlarm = true;
+    datastore.addEvent(DATASTORE_EVENT_LOW_VOLTAGE_ALARM);
     Beeper::playTune(lowVoltageTune);
   }
 }
@@ -467,6 +760,7 @@ void soundLostModelAlarm()
   {
     printMessage(START_LMA_MESSAGE);
     lostModelAlarm = true;
+    datastore.addEvent(DATASTORE_EVENT_LOST_MODEL_ALARM);
     stopLogging();
     Beeper::playTune(lostModelTune);
   }
@@ -503,16 +797,24 @@ void programSettings()
   while (Serial.available() < SETTINGS_SIZE) {}
   for (int i = 0; i < SETTINGS_SIZE; i++) settingsBytes[i] = (byte)Serial.read();
   SettingsStore::save(&settings);
+  setLogChannels();
   Beeper::playTune(settingsSaveTune);
   Beeper::waitForTuneToEnd();
 }
 
+// the servo channel is only stored in the log if it's being logged
+void setLogChannels()
+{
+  if (settings.logServo) datastore.setChannels(DATASTORE_ALL_CHANNELS);
+  else datastore.setChannels(DATASTORE_ALL_CHANNELS & ~DATASTORE_CHANNEL_SERVO);
+}
+
 // this function outputs the current settings to the serial port
 void readSettings()
 {
   stopLogging();
   byte* settingsBytes = (byte*)&settings;
-  for (int i = 0; i < SETTINGS_SIZE; i++) Serial.write(settingsBytes[i]);
+  for (int i = 0; i < SETTINGS_SIZE; i++) SerialOut.write(settingsBytes[i]);
 }
 
 // this adds a fake flight to the logger's memory. Useful for testing.
@@ -569,11 +871,13 @@ void uploadLogEntry()
   int battery;
   int servo;
   int servo2;
-  int numRead = sscanf(sBuffer, "P: %ld T: %d B: %d S: %d", &pressure, &temperature, &battery, &servo);
+  int numRead = sscanf_P(sBuffer, PSTR("P: %ld T: %d B: %d S: %d"), &pressure, &temperature, &battery, &servo);
   if (numRead != 4) return;
   if (pressure == -1)
   {
     datastore.addFileEndMarker();
+    pressureHistory.clear();
+    climbFilter.reset();
     return;
   }
   else
@@ -584,6 +888,10 @@ void uploadLogEntry()
     le.setBattery((float)battery / 100);
     le.setServo(servo);
     
+    // the replayed entries stand in for the pressure conversions, one per log interval. That can be longer
+    // than the gap that would start the filter again when it's live.
+    climbFilter.addReplayed(pressure, climbFilter.getTime() + settings.logIntervalMS);
+    if (climbFilter.hasNewEstimate()) updateHeightMonitor();
     addLogEntry(&le);
   }
 }
@@ -591,6 +899,7 @@ void uploadLogEntry()
 void selfTest()
 {
   stopLogging();
+  download.stop();
   printMessage(DIAG_RUN_MESSAGE);
   flash.test();
 //  datastore.test();
@@ -601,27 +910,42 @@ void selfTest()
   radio.test();
   SettingsStore::test();
   
+  // shows what measuring the temperature less often buys: the time per sample, and the pressure
+  // noise, with the temperature measured every sample and then at the configured interval.
+  printMessage(SENSOR_TIMING_TEST_MESSAGE);
+  testSensorTiming(0, ALTIMETER_OSP / 2);
+  testSensorTiming(0, ALTIMETER_OSP);
+  testSensorTiming(ALTIMETER_TEMPERATURE_INTERVAL_MS, ALTIMETER_OSP / 2);
+  testSensorTiming(ALTIMETER_TEMPERATURE_INTERVAL_MS, ALTIMETER_OSP);
+  pressureSensor.setTemperatureInterval(ALTIMETER_TEMPERATURE_INTERVAL_MS);
+  
   // we log a number of entries and then look at the range of the logged values
   // (this is easier than computing the s.d., and does the job pretty much as well.)
-  Serial.println("Testing sensor noise.");
+  printMessage(SENSOR_NOISE_TEST_MESSAGE);
   logging = true;
-  for (int i = 0; i < NUMBER_OF_TEST_LOGS; i++) log();
+  for (int i = 0; i < NUMBER_OF_TEST_LOGS; i++)
+  {
+    pressureSensor.softOversample(ALTIMETER_OST, ALTIMETER_OSP);
+    LogEntry le;
+    makeLogEntry(&le, pressureSensor.pressure);
+    addLogEntry(&le);
+  }
   logging = false;
 
   LogEntry le;
   int32_t pMin, pMax, tMin, tMax;
   float vMin, vMax;
-  datastore.startRead();
-  datastore.getNextEntry(&le);
+  DatastoreCursor cursor;
+  datastore.openCursor(&cursor);
+  datastore.getNextEntry(&cursor, &le);
   pMin = le.getPressure();
   pMax = le.getPressure();
   tMin = le.getTemperature();
   tMax = le.getTemperature();
   vMin = le.getBattery();
   vMax = le.getBattery();
-  while( datastore.entryAvailable() )
+  while( datastore.entryAvailable(&cursor) && datastore.getNextEntry(&cursor, &le) )
   {
-    datastore.getNextEntry(&le);
     if (le.getPressure() < pMin) pMin = le.getPressure();
     if (le.getTemperature() < tMin) tMin = le.getTemperature();
     if (le.getBattery() < vMin) vMin = le.getBattery();
@@ -629,20 +953,43 @@ void selfTest()
     if (le.getTemperature() > tMax) tMax = le.getTemperature();
     if (le.getBattery() > vMax) vMax = le.getBattery();
   }
+  datastore.closeCursor(&cursor);
   int32_t deltaP = pMax - pMin;
   int32_t deltaT = tMax - tMin;
   float deltaV = vMax - vMin;
-  Serial.println();
-  Serial.print("deltaP: ");
-  Serial.println(deltaP);
-  Serial.print("deltaT: ");
-  Serial.println(deltaT);
-  Serial.print("deltaV: ");
-  Serial.println(deltaV);
+  SerialOut.println();
+  printMessage(DELTA_P_MESSAGE);
+  SerialOut.println(deltaP);
+  printMessage(DELTA_T_MESSAGE);
+  SerialOut.println(deltaT);
+  printMessage(DELTA_V_MESSAGE);
+  SerialOut.println(deltaV);
   
   // max deviation of 150 hPa, 1.5 degree C, and 100mV is acceptable
   if (deltaP < 150 && deltaT < 15 && deltaV < 0.1) printMessage(TEST_PASS_MESSAGE);
   else printMessage(TEST_FAIL_MESSAGE);
   
   printMessage(DIAG_DONE_MESSAGE);
+}
+
+void testSensorTiming(uint32_t temperatureIntervalMS, uint8_t osp)
+{
+  int32_t pMin, pMax;
+  pressureSensor.setTemperatureInterval(temperatureIntervalMS);
+  uint32_t startTime = millis();
+  for (int i = 0; i < NUMBER_OF_TIMING_TEST_SAMPLES; i++)
+  {
+    pressureSensor.softOversample(ALTIMETER_OST, osp);
+    if (i == 0 || pressureSensor.pressure < pMin) pMin = pressureSensor.pressure;
+    if (i == 0 || pressureSensor.pressure > pMax) pMax = pressureSensor.pressure;
+  }
+  uint32_t sampleTime = (millis() - startTime) / NUMBER_OF_TIMING_TEST_SAMPLES;
+  printMessage(TEMPERATURE_INTERVAL_MESSAGE);
+  SerialOut.print(temperatureIntervalMS);
+  printMessage(OSP_MESSAGE);
+  SerialOut.print((int)osp);
+  printMessage(SAMPLE_TIME_MESSAGE);
+  SerialOut.print(sampleTime);
+  printMessage(SAMPLE_DELTA_P_MESSAGE);
+  SerialOut.println(pMax - pMin);
 }
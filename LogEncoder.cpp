@@ -0,0 +1,206 @@
+/*
+    openaltimeter -- an open-source altimeter for RC aircraft
+    Copyright (C) 2010  Jony Hudson
+    http://openaltimeter.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "LogEncoder.h"
+#include "WProgram.h"
+#include "SerialOutput.h"
+
+// the sample fields that are sent as "same as last time" or a byte, in the order they're stored
+static const uint8_t _logEncoderFields[] = {DATASTORE_FIELD_TEMPERATURE, DATASTORE_FIELD_BATTERY, DATASTORE_FIELD_SERVO};
+
+LogEncoder::LogEncoder(Datastore* datastore)
+{
+  _datastore = datastore;
+  start();
+}
+
+void LogEncoder::start()
+{
+  _recordFill = 0;
+  _rawRemaining = 0;
+  _extendedStarted = false;
+  _pressure = 0;
+  _lastTag = 0;
+  memset(_lastFields, 0, sizeof(_lastFields));
+  _riceSum = 4;
+  _riceCount = 1;
+  _bits = 0;
+  _bitCount = 0;
+}
+
+// the data can be split up anywhere, not just between records.
+void LogEncoder::encode(uint8_t* data, uint16_t num)
+{
+  for (uint16_t i = 0; i < num; i++) encodeByte(data[i]);
+}
+
+void LogEncoder::finish()
+{
+  // a sample record that was cut off
+  for (uint8_t i = 0; i < _recordFill; i++) writeRaw(_record[i]);
+  _recordFill = 0;
+  writeBits(0x0f, 4);
+  if (_bitCount > 0) SerialOut.write((uint8_t)(_bits << (8 - _bitCount)));
+  _bitCount = 0;
+}
+
+// the most bytes that can be given to encode() without it writing more than outputSpace bytes, whatever
+// they are. A sample record isn't written until it's all there, so the part of one that's being held
+// counts against the space, as do the bits that are waiting to make up a byte.
+uint16_t LogEncoder::maxInput(uint16_t outputSpace)
+{
+  uint32_t bits = (uint32_t)outputSpace * 8;
+  if (bits <= _bitCount) return 0;
+  uint16_t bytes = (bits - _bitCount) / LOG_ENCODER_MAX_BITS_PER_BYTE;
+  return (bytes > _recordFill) ? bytes - _recordFill : 0;
+}
+
+void LogEncoder::encodeByte(uint8_t b)
+{
+  if (_extendedStarted)
+  {
+    // this is the length, and the tag has already been sent
+    _extendedStarted = false;
+    _rawRemaining = _datastore->recordLength(DATASTORE_TAG_EXTENDED, b) - 2;
+    writeRaw(b);
+    return;
+  }
+  if (_rawRemaining > 0)
+  {
+    _rawRemaining--;
+    writeRaw(b);
+    return;
+  }
+  if (_recordFill > 0)
+  {
+    _record[_recordFill++] = b;
+    if (_recordFill == _recordLength) encodeSample();
+    return;
+  }
+  // the start of a record
+  if (b != DATASTORE_TAG_PAD && b < DATASTORE_TAG_SAMPLE)
+  {
+    int8_t delta = (int16_t)b - DATASTORE_DELTA_OFFSET;
+    writeBits(0, 1);
+    writeValue(delta);
+    _pressure += delta;
+    return;
+  }
+  if ((b & DATASTORE_TAG_MASK) == DATASTORE_TAG_SAMPLE)
+  {
+    _record[0] = b;
+    _recordFill = 1;
+    _recordLength = _datastore->recordLength(b, 0);
+    return;
+  }
+  if ((b & DATASTORE_TAG_MASK) == DATASTORE_TAG_EXTENDED) _extendedStarted = true;
+  writeRaw(b);
+}
+
+void LogEncoder::encodeSample()
+{
+  uint8_t tag = _record[0];
+  _recordFill = 0;
+  if (_record[_recordLength - 1] != tag)
+  {
+    for (uint8_t i = 0; i < _recordLength; i++) writeRaw(_record[i]);
+    return;
+  }
+  if (tag == _lastTag) writeBits(0x02, 2);
+  else
+  {
+    writeBits(0x06, 3);
+    writeBits(tag & ~DATASTORE_TAG_MASK, 5);
+    _lastTag = tag;
+  }
+  uint8_t i = 1;
+  if (tag & DATASTORE_FIELD_ABSOLUTE_PRESSURE)
+  {
+    int16_t pressure = (int16_t)(_record[1] | (_record[2] << 8));
+    writeValue(pressure - _pressure);
+    _pressure = pressure;
+    i = 3;
+  }
+  else
+  {
+    int8_t delta = (int8_t)_record[i++];
+    writeValue(delta);
+    _pressure += delta;
+  }
+  for (uint8_t field = 0; field < sizeof(_logEncoderFields); field++)
+  {
+    if (!(tag & _logEncoderFields[field])) continue;
+    if (_record[i] == _lastFields[field]) writeBits(0, 1);
+    else
+    {
+      writeBits(1, 1);
+      writeBits(_record[i], 8);
+      _lastFields[field] = _record[i];
+    }
+    i++;
+  }
+}
+
+void LogEncoder::writeRaw(uint8_t b)
+{
+  writeBits(0x0e, 4);
+  writeBits(b, 8);
+}
+
+// an adaptive Rice code, as described in LogEncoder.h.
+void LogEncoder::writeValue(int16_t value)
+{
+  uint16_t folded = ((uint16_t)value << 1) ^ (uint16_t)(value >> 15);
+  uint8_t k = 0;
+  while (((uint16_t)_riceCount << k) < _riceSum) k++;
+  uint16_t ones = folded >> k;
+  if (ones < LOG_ENCODER_MAX_UNARY)
+  {
+    for (uint8_t i = 0; i < ones; i++) writeBits(1, 1);
+    writeBits(0, 1);
+    writeBits(folded, k);
+  }
+  else
+  {
+    writeBits(0xffff, LOG_ENCODER_MAX_UNARY);
+    writeBits(folded, 16);
+  }
+  _riceSum += (folded < 256) ? folded : 256;
+  if (++_riceCount == 16)
+  {
+    _riceSum >>= 1;
+    _riceCount >>= 1;
+  }
+}
+
+// writes the low count bits, most significant first.
+void LogEncoder::writeBits(uint16_t bits, uint8_t count)
+{
+  while (count > 0)
+  {
+    count--;
+    _bits = (_bits << 1) | ((bits >> count) & 1);
+    if (++_bitCount == 8)
+    {
+      SerialOut.write(_bits);
+      _bitCount = 0;
+    }
+  }
+}
@@ -0,0 +1,85 @@
+/*
+    openaltimeter -- an open-source altimeter for RC aircraft
+    Copyright (C) 2010  Jony Hudson
+    http://openaltimeter.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LOGENCODER_H
+#define LOGENCODER_H
+
+#include "WProgram.h"
+#include "config.h"
+
+#include "Datastore.h"
+
+// The log encoder squeezes the raw log down as it's sent, for the compressed download. The host
+// gets back exactly the bytes that it would have had from the raw download. The output is a
+// stream of codes, most significant bit first, and each code is one of:
+//   0 value              a pressure delta record, with the delta as the value
+//   10 sample            a sample record with the same tag as the last one
+//   110 fields sample    a sample record with a new tag: the low 5 bits of the tag, then the sample
+//   1110 byte            one byte as it is, for everything else
+//   1111                 the end, after which the last byte is padded out with zeros
+// A sample is the pressure, as the difference from the last pressure if it's absolute or as its delta
+// if not, and then for each of the temperature, battery and servo fields that are in the tag, a 0 if
+// it's the same as that field last was, or a 1 and the byte. The closing tag is left out. Values are
+// signed numbers, folded into unsigned ones (0, -1, 1, -2 ...) and Rice coded: value >> k ones, a
+// zero, then the low k bits of the value. k adapts to the size of the recent values: it's the
+// smallest that makes count << k at least sum, where sum starts at 4 and count at 1, and each value
+// adds min(value, 256) to sum and one to count, with both halved when count gets to 16. A value that
+// would need LOG_ENCODER_MAX_UNARY or more ones is sent as that many ones and then its 16 bits. The
+// pressure, the last tag and the last fields start at zero.
+// Only whole sample records are coded as samples, and records that don't look right are sent a byte
+// at a time, so any data gets through unchanged.
+#define LOG_ENCODER_MAX_UNARY 16
+// the most bits that one byte of the log can be coded as. That's a pressure delta record that needs the
+// escape: a 0, LOG_ENCODER_MAX_UNARY ones and the 16 bits. Nothing else takes as many for its length.
+#define LOG_ENCODER_MAX_BITS_PER_BYTE (1 + LOG_ENCODER_MAX_UNARY + 16)
+
+class LogEncoder
+{
+  public:
+    LogEncoder(Datastore* datastore);
+    void start();
+    void encode(uint8_t* data, uint16_t num);
+    void finish();
+    uint16_t maxInput(uint16_t outputSpace);
+  private:
+    Datastore* _datastore;
+    // the sample record that's being collected, or the number of bytes of an extended record still to
+    // be sent as they are
+    uint8_t _record[DATASTORE_MAX_SAMPLE_SIZE];
+    uint8_t _recordFill;
+    uint8_t _recordLength;
+    uint8_t _rawRemaining;
+    boolean _extendedStarted;
+    // what the decoder knows, which each code is relative to
+    int16_t _pressure;
+    uint8_t _lastTag;
+    uint8_t _lastFields[3];
+    uint16_t _riceSum;
+    uint8_t _riceCount;
+    // bits waiting to be sent, in the low end of _bits
+    uint8_t _bits;
+    uint8_t _bitCount;
+    void encodeByte(uint8_t b);
+    void encodeSample();
+    void writeRaw(uint8_t b);
+    void writeValue(int16_t value);
+    void writeBits(uint16_t bits, uint8_t count);
+};
+
+#endif /*LOGENCODER_H*/
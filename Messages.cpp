@@ -21,14 +21,12 @@
 #include "Messages.h"
 
 #include "WProgram.h"
+#include "SerialOutput.h"
 
 // The messages are collected together here to make it easier to store them in flash.
 // This is a bit awkward, as we have to store them all in a table and then index them
 // using defines. I don't know of a better way to do it.
 
-// this must be longer than the longest message
-#define MESSAGE_BUFFER_LENGTH 80
-
 // the welcome message prints the build version. This should correspond to the tag in the SVN repository.
 // The first word of this string must be openaltimeter, as it's what the desktop app uses to 
 // verify that it's connected.
@@ -63,7 +61,7 @@ char _m27[] PROGMEM = "Flash memory full.\n";
 char _m28[] PROGMEM = "Test: FAILED.\n";
 // the data format message can be used by the downloader app to parse the downloaded
 // data correctly.
-char _m29[] PROGMEM = "Data format: V1\n";
+char _m29[] PROGMEM = "Data format: V3\n";
 char _m30[] PROGMEM = "Erasing settings ...";
 char _m31[] PROGMEM = "Testing settings store ...";
 char _m32[] PROGMEM = "Settings format: V6\n";
@@ -87,6 +85,36 @@ char _m49[] PROGMEM = "Max height: ";
 char _m50[] PROGMEM = "Launch height: ";
 char _m51[] PROGMEM = "Glide height: ";
 char _m52[] PROGMEM = "Battery voltage: ";
+char _m53[] PROGMEM = "Sequential write rate: ";
+char _m54[] PROGMEM = "Page write rate: ";
+char _m55[] PROGMEM = "Write queue depth: ";
+char _m56[] PROGMEM = "Write queue stalls: ";
+char _m57[] PROGMEM = "Datastore mount time (ms): ";
+char _m58[] PROGMEM = "Log is in an old data format. Download it, then erase.\n";
+char _m59[] PROGMEM = "Erase time (ms): ";
+char _m60[] PROGMEM = "Serial output stalls: ";
+char _m61[] PROGMEM = "Error in flash, test block ";
+char _m62[] PROGMEM = " bytes/s\n";
+char _m63[] PROGMEM = "Testing pressure sensor ...\n";
+char _m64[] PROGMEM = "P: ";
+char _m65[] PROGMEM = " T: ";
+char _m66[] PROGMEM = " B: ";
+char _m67[] PROGMEM = " S: ";
+char _m68[] PROGMEM = "Altitude conversion cycles: ";
+char _m69[] PROGMEM = " pow(): ";
+char _m70[] PROGMEM = "Done.\n";
+char _m71[] PROGMEM = "Outputting ";
+char _m72[] PROGMEM = "Testing radio ...\n";
+char _m73[] PROGMEM = "Build: ";
+char _m74[] PROGMEM = "Testing sensor timing.\n";
+char _m75[] PROGMEM = "Testing sensor noise.\n";
+char _m76[] PROGMEM = "deltaP: ";
+char _m77[] PROGMEM = "deltaT: ";
+char _m78[] PROGMEM = "deltaV: ";
+char _m79[] PROGMEM = "temperature interval: ";
+char _m80[] PROGMEM = " osp: ";
+char _m81[] PROGMEM = " sample time: ";
+char _m82[] PROGMEM = " deltaP: ";
 
 
 // This table must include all the messages you want to use.
@@ -97,13 +125,15 @@ PGM_P _messages[] PROGMEM =
   _m0, _m1, _m2, _m3, _m4, _m5, _m6, _m7, _m8, _m9, _m10, _m11, _m12, _m13, _m14, _m15,
   _m16, _m17, _m18, _m19, _m20, _m21, _m22, _m23, _m24, _m25, _m26, _m27, _m28, _m29, _m30,
   _m31, _m32, _m33, _m34, _m35, _m36, _m37, _m38, _m39, _m40, _m41, _m42, _m43, _m44, _m45,
-  _m46, _m47, _m48, _m49, _m50, _m51, _m52
+  _m46, _m47, _m48, _m49, _m50, _m51, _m52, _m53, _m54, _m55, _m56, _m57, _m58, _m59,
+  _m60, _m61, _m62, _m63, _m64, _m65, _m66, _m67, _m68, _m69, _m70, _m71, _m72, _m73, _m74, _m75,
+  _m76, _m77, _m78, _m79, _m80, _m81, _m82
 };
 
-char _messageBuffer[MESSAGE_BUFFER_LENGTH];
-
+// the message is sent straight from the program memory, rather than being copied into RAM first.
 void printMessage(int messageIndex)
 {
-  strcpy_P(_messageBuffer, (PGM_P)pgm_read_word(&(_messages[messageIndex])));
-  Serial.print(_messageBuffer);
+  PGM_P message = (PGM_P)pgm_read_word(&(_messages[messageIndex]));
+  char c;
+  while ((c = pgm_read_byte(message++)) != 0) SerialOut.write(c);
 }
@@ -77,6 +77,36 @@
 #define OUTPUT_MAX_LAUNCH_HEIGHT_MESSAGE 50
 #define OUTPUT_LAUNCH_WINDOW_END_HEIGHT_MESSAGE 51
 #define OUTPUT_BATTERY_VOLTAGE_MESSAGE 52
+#define FLASH_SEQUENTIAL_WRITE_RATE_MESSAGE 53
+#define FLASH_PAGE_WRITE_RATE_MESSAGE 54
+#define WRITE_QUEUE_DEPTH_MESSAGE 55
+#define WRITE_STALLS_MESSAGE 56
+#define DATASTORE_MOUNT_TIME_MESSAGE 57
+#define OLD_DATA_FORMAT_MESSAGE 58
+#define ERASE_TIME_MESSAGE 59
+#define SERIAL_STALLS_MESSAGE 60
+#define FLASH_TEST_BLOCK_ERROR_MESSAGE 61
+#define BYTES_PER_SECOND_MESSAGE 62
+#define PRESSURE_SENSOR_TEST_MESSAGE 63
+#define PRESSURE_LABEL_MESSAGE 64
+#define TEMPERATURE_LABEL_MESSAGE 65
+#define BATTERY_LABEL_MESSAGE 66
+#define SERVO_LABEL_MESSAGE 67
+#define ALTITUDE_CONVERSION_CYCLES_MESSAGE 68
+#define POW_CYCLES_MESSAGE 69
+#define PRESSURE_SENSOR_TEST_DONE_MESSAGE 70
+#define OUTPUTTING_MESSAGE 71
+#define RADIO_TEST_MESSAGE 72
+#define BUILD_MESSAGE 73
+#define SENSOR_TIMING_TEST_MESSAGE 74
+#define SENSOR_NOISE_TEST_MESSAGE 75
+#define DELTA_P_MESSAGE 76
+#define DELTA_T_MESSAGE 77
+#define DELTA_V_MESSAGE 78
+#define TEMPERATURE_INTERVAL_MESSAGE 79
+#define OSP_MESSAGE 80
+#define SAMPLE_TIME_MESSAGE 81
+#define SAMPLE_DELTA_P_MESSAGE 82
 
 
 void printMessage(int messageIndex);
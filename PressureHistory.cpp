@@ -0,0 +1,75 @@
+/*
+    openaltimeter -- an open-source altimeter for RC aircraft
+    Copyright (C) 2010  Jony Hudson
+    http://openaltimeter.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "PressureHistory.h"
+#include "WProgram.h"
+
+// this matches the offset used by the log entries
+#define PRESSURE_HISTORY_OFFSET 101325
+
+PressureHistory::PressureHistory()
+{
+  clear();
+}
+
+void PressureHistory::add(int32_t pressure)
+{
+  _samples[_head] = (int16_t)(pressure - (int32_t)PRESSURE_HISTORY_OFFSET);
+  if (++_head == PRESSURE_HISTORY_LENGTH) _head = 0;
+  if (_count < PRESSURE_HISTORY_LENGTH) _count++;
+}
+
+void PressureHistory::clear()
+{
+  _head = 0;
+  _count = 0;
+}
+
+uint8_t PressureHistory::getNumberOfSamples()
+{
+  return _count;
+}
+
+int32_t PressureHistory::getSample(uint8_t age)
+{
+  // _head points at the slot after the newest sample
+  int16_t index = (int16_t)_head - 1 - age;
+  if (index < 0) index += PRESSURE_HISTORY_LENGTH;
+  return (int32_t)_samples[index] + (int32_t)PRESSURE_HISTORY_OFFSET;
+}
+
+uint8_t PressureHistory::windowSize(uint8_t n)
+{
+  return (n < _count) ? n : _count;
+}
+
+// this returns zero if the history is empty
+int32_t PressureHistory::getMax(uint8_t n)
+{
+  n = windowSize(n);
+  if (n == 0) return 0;
+  int32_t max = getSample(0);
+  for (uint8_t i = 1; i < n; i++)
+  {
+    int32_t sample = getSample(i);
+    if (sample > max) max = sample;
+  }
+  return max;
+}
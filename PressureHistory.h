@@ -0,0 +1,47 @@
+/*
+    openaltimeter -- an open-source altimeter for RC aircraft
+    Copyright (C) 2010  Jony Hudson
+    http://openaltimeter.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PRESSUREHISTORY_H
+#define PRESSUREHISTORY_H
+
+#include "WProgram.h"
+#include "config.h"
+
+// The pressure history keeps the most recent pressure samples in a small ring in RAM, so that the
+// height detectors can look back over the last few samples without reading back from the flash.
+// The samples are stored in the same 16-bit form as the log entries. The windowed query looks at
+// the newest n samples, or fewer if the history doesn't hold that many yet.
+class PressureHistory
+{
+  public:
+    PressureHistory();
+    void add(int32_t pressure);
+    void clear();
+    uint8_t getNumberOfSamples();
+    // age 0 is the most recent sample
+    int32_t getSample(uint8_t age);
+    int32_t getMax(uint8_t n);
+  private:
+    uint8_t windowSize(uint8_t n);
+    int16_t _samples[PRESSURE_HISTORY_LENGTH];
+    uint8_t _head;
+    uint8_t _count;
+};
+
+#endif /*PRESSUREHISTORY_H*/
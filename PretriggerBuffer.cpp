@@ -0,0 +1,53 @@
+/*
+    openaltimeter -- an open-source altimeter for RC aircraft
+    Copyright (C) 2010  Jony Hudson
+    http://openaltimeter.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "PretriggerBuffer.h"
+#include "WProgram.h"
+
+PretriggerBuffer::PretriggerBuffer()
+{
+  clear();
+}
+
+void PretriggerBuffer::add(LogEntry* entry)
+{
+  _entries[_head] = *entry;
+  if (++_head == LOG_PRETRIGGER_LENGTH) _head = 0;
+  if (_count < LOG_PRETRIGGER_LENGTH) _count++;
+}
+
+void PretriggerBuffer::clear()
+{
+  _head = 0;
+  _count = 0;
+}
+
+uint8_t PretriggerBuffer::getNumberOfEntries()
+{
+  return _count;
+}
+
+void PretriggerBuffer::getEntry(uint8_t age, LogEntry* entry)
+{
+  // _head points at the slot after the newest entry
+  int16_t index = (int16_t)_head - 1 - age;
+  if (index < 0) index += LOG_PRETRIGGER_LENGTH;
+  *entry = _entries[index];
+}
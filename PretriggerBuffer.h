@@ -0,0 +1,45 @@
+/*
+    openaltimeter -- an open-source altimeter for RC aircraft
+    Copyright (C) 2010  Jony Hudson
+    http://openaltimeter.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PRETRIGGERBUFFER_H
+#define PRETRIGGERBUFFER_H
+
+#include "WProgram.h"
+#include "config.h"
+#include "Datastore.h"
+
+// The pre-trigger buffer keeps the most recent log entries in a small ring in RAM, at a higher rate
+// than they're being stored, so that when something interesting happens the time just before it can
+// be stored in detail too. When it's full the oldest entry is dropped to make room.
+class PretriggerBuffer
+{
+  public:
+    PretriggerBuffer();
+    void add(LogEntry* entry);
+    void clear();
+    uint8_t getNumberOfEntries();
+    // age 0 is the most recent entry
+    void getEntry(uint8_t age, LogEntry* entry);
+  private:
+    LogEntry _entries[LOG_PRETRIGGER_LENGTH];
+    uint8_t _head;
+    uint8_t _count;
+};
+
+#endif /*PRETRIGGERBUFFER_H*/
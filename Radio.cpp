@@ -22,6 +22,7 @@
 #include "WProgram.h"
 
 #include "Messages.h"
+#include "SerialOutput.h"
 
 #define RADIO_TIMEOUT 28000
 #define RADIO_NOISE_THRESHOLD 75
@@ -84,12 +85,12 @@ uint16_t Radio::getServoValueQuick()
 
 void Radio::test()
 {
-  Serial.println("Testing radio ...");
+  printMessage(RADIO_TEST_MESSAGE);
   uint16_t r1 = getRawValue();
-  Serial.println(r1);
+  SerialOut.println(r1);
   // temp code for testing the other radio channel
   uint16_t r2 = pulseIn(9, HIGH, RADIO_TIMEOUT);
-  Serial.println(r2);
+  SerialOut.println(r2);
   // r1 should be between 990 and 1020, and r2 between 1480 and 1520 to pass the test
   if (r1 < 1120 && r1 > 1060 && r2 > 1060 && r2 < 1120) printMessage(TEST_PASS_MESSAGE);
   else printMessage(TEST_FAIL_MESSAGE);
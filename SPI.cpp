@@ -32,21 +32,19 @@ void SPI::setup()
   pinMode(SPI_MISO_PIN, INPUT);
   // enable the MISO pullup resistor
   digitalWrite(SPI_MISO_PIN, HIGH);
-  // enable SPI in Master Mode with SCK = CK/4
+  // enable SPI in Master Mode, and then set the clock rate
   SPCR = _BV(SPE) | _BV(MSTR);
+  setClockDivider(SPI_CLOCK_DIVIDER);
   // clear the SPI registers
   IOReg = SPSR;
   IOReg = SPDR;
 }
 
-void SPI::assertSS(int ssPin)
+void SPI::setClockDivider(uint8_t divider)
 {
-  digitalWrite(ssPin, LOW);
-}
-
-void SPI::deassertSS(int ssPin)
-{
-  digitalWrite(ssPin, HIGH);
+  SPCR = (SPCR & ~(_BV(SPR1) | _BV(SPR0))) | (divider & 0x03);
+  if (divider & 0x04) SPSR |= _BV(SPI2X);
+  else SPSR &= ~_BV(SPI2X);
 }
 
 unsigned char SPI::exchangeByte(unsigned char data)
@@ -57,4 +55,52 @@ unsigned char SPI::exchangeByte(unsigned char data)
     return SPDR;
 }
 
+// The block transfer functions keep the bus busy by loading the next byte as soon as the last one
+// has gone. The next byte is fetched from the buffer while the current one is being shifted out, so
+// there's as little time as possible between bytes.
+void SPI::transmit(const uint8_t* buffer, uint16_t num)
+{
+  if (num == 0) return;
+  SPDR = *buffer++;
+  while (--num)
+  {
+    uint8_t next = *buffer++;
+    loop_until_bit_is_set(SPSR, SPIF);
+    SPDR = next;
+  }
+  loop_until_bit_is_set(SPSR, SPIF);
+}
+
+// this clocks out zeros while receiving
+void SPI::receive(uint8_t* buffer, uint16_t num)
+{
+  if (num == 0) return;
+  SPDR = 0;
+  while (--num)
+  {
+    loop_until_bit_is_set(SPSR, SPIF);
+    uint8_t received = SPDR;
+    SPDR = 0;
+    *buffer++ = received;
+  }
+  loop_until_bit_is_set(SPSR, SPIF);
+  *buffer = SPDR;
+}
+
+// sends the contents of the buffer, replacing them with the bytes received
+void SPI::exchange(uint8_t* buffer, uint16_t num)
+{
+  if (num == 0) return;
+  SPDR = buffer[0];
+  for (uint16_t i = 1; i < num; i++)
+  {
+    uint8_t next = buffer[i];
+    loop_until_bit_is_set(SPSR, SPIF);
+    buffer[i - 1] = SPDR;
+    SPDR = next;
+  }
+  loop_until_bit_is_set(SPSR, SPIF);
+  buffer[num - 1] = SPDR;
+}
+
 SPI Spi;
@@ -27,13 +27,31 @@
 #define SPI_MISO_PIN 12
 #define SPI_SCLK_PIN 13
 
+// clock dividers for setClockDivider(). Bit 2 is the SPI2X bit, which doubles the clock rate
+// set by the SPR1:0 bits in the bottom two bits.
+#define SPI_CLOCK_DIV2 0x04
+#define SPI_CLOCK_DIV4 0x00
+#define SPI_CLOCK_DIV8 0x05
+#define SPI_CLOCK_DIV16 0x01
+#define SPI_CLOCK_DIV32 0x06
+#define SPI_CLOCK_DIV64 0x02
+#define SPI_CLOCK_DIV128 0x03
+
+// These select and deselect a device by writing its port register directly, which is much quicker
+// than digitalWrite. The port and bit should be compile-time constants, so that they compile down
+// to single sbi/cbi instructions.
+#define SPI_FAST_ASSERT_SS(port, bit) ((port) &= ~_BV(bit))
+#define SPI_FAST_DEASSERT_SS(port, bit) ((port) |= _BV(bit))
+
 class SPI
 {
   public:
     void setup();
-    void assertSS(int ssPin);
-    void deassertSS(int ssPin);
+    void setClockDivider(uint8_t divider);
     unsigned char exchangeByte(unsigned char data);
+    void transmit(const uint8_t* buffer, uint16_t num);
+    void receive(uint8_t* buffer, uint16_t num);
+    void exchange(uint8_t* buffer, uint16_t num);
 };
 
 extern SPI Spi;
@@ -0,0 +1,110 @@
+/*
+    openaltimeter -- an open-source altimeter for RC aircraft
+    Copyright (C) 2010  Jony Hudson
+    http://openaltimeter.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "SerialOutput.h"
+#include <avr/interrupt.h>
+#include <avr/io.h>
+
+#include "WProgram.h"
+
+#define SERIAL_OUTPUT_INDEX_MASK (SERIAL_OUTPUT_BUFFER_SIZE - 1)
+
+SerialOutput::SerialOutput()
+{
+  _head = 0;
+  _tail = 0;
+  _sent = false;
+  _stalls = 0;
+}
+
+void SerialOutput::write(uint8_t b)
+{
+  uint8_t next = (_head + 1) & SERIAL_OUTPUT_INDEX_MASK;
+  if (next == _tail)
+  {
+    _stalls++;
+    while (next == _tail) service();
+  }
+  _buffer[_head] = b;
+  _head = next;
+  _sent = true;
+  // the interrupt turns itself off when the buffer's empty
+  UCSR0B |= _BV(UDRIE0);
+}
+
+void SerialOutput::write(const uint8_t* buffer, size_t size)
+{
+  while (size-- > 0) write(*buffer++);
+}
+
+uint8_t SerialOutput::getFree()
+{
+  return (_tail - _head - 1) & SERIAL_OUTPUT_INDEX_MASK;
+}
+
+uint32_t SerialOutput::getStalls()
+{
+  return _stalls;
+}
+
+void SerialOutput::waitUntilSent()
+{
+  if (!_sent) return;
+  while (_head != _tail) service();
+  while (!(UCSR0A & _BV(TXC0))) {}
+  _sent = false;
+}
+
+// starts the sending again if it was paused by the host.
+void SerialOutput::service()
+{
+#ifdef SERIAL_CTS_PIN
+  if (_head != _tail && digitalRead(SERIAL_CTS_PIN) == LOW) UCSR0B |= _BV(UDRIE0);
+#endif
+}
+
+void SerialOutput::sendNext()
+{
+#ifdef SERIAL_CTS_PIN
+  if (digitalRead(SERIAL_CTS_PIN) == HIGH)
+  {
+    UCSR0B &= ~_BV(UDRIE0);
+    return;
+  }
+#endif
+  if (_head == _tail)
+  {
+    UCSR0B &= ~_BV(UDRIE0);
+    return;
+  }
+  UDR0 = _buffer[_tail];
+  _tail = (_tail + 1) & SERIAL_OUTPUT_INDEX_MASK;
+  // writing a one clears the transmit complete flag, which is set again once this byte has gone. The
+  // register is written rather than or-ed, so that the other flags that are there aren't cleared too,
+  // but U2X0 has to be kept as it is.
+  UCSR0A = _BV(TXC0) | (UCSR0A & _BV(U2X0));
+}
+
+ISR(USART_UDRE_vect)
+{
+  SerialOut.sendNext();
+}
+
+SerialOutput SerialOut;
@@ -0,0 +1,60 @@
+/*
+    openaltimeter -- an open-source altimeter for RC aircraft
+    Copyright (C) 2010  Jony Hudson
+    http://openaltimeter.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SERIALOUTPUT_H
+#define SERIALOUTPUT_H
+
+#include "WProgram.h"
+#include "config.h"
+
+// The serial output goes through a ring buffer, which the UART's data register empty interrupt sends
+// on in the background, so printing doesn't hold up the logging unless the buffer fills up. All
+// output should go through SerialOut rather than Serial, so that it comes out in order. Serial is
+// still used for setting the rate and for reading.
+// If SERIAL_CTS_PIN is defined, then sending pauses while the host holds that pin high.
+class SerialOutput : public Print
+{
+  public:
+    SerialOutput();
+    // these wait if the buffer's full
+    virtual void write(uint8_t b);
+    virtual void write(const uint8_t* buffer, size_t size);
+    using Print::write;
+    // the number of bytes that can be written without waiting
+    uint8_t getFree();
+    uint32_t getStalls();
+    // waits until everything has gone out of the UART, which must be done before its rate is changed
+    void waitUntilSent();
+    void service();
+    // this is only for the interrupt handler
+    void sendNext();
+  private:
+    volatile uint8_t _buffer[SERIAL_OUTPUT_BUFFER_SIZE];
+    // the next byte to send, and the slot for the next byte written
+    volatile uint8_t _tail;
+    volatile uint8_t _head;
+    // whether anything has been sent since the last waitUntilSent(), as that's what sets the
+    // transmit complete flag
+    boolean _sent;
+    uint32_t _stalls;
+};
+
+extern SerialOutput SerialOut;
+
+#endif /*SERIALOUTPUT_H*/
@@ -22,6 +22,7 @@
 #include "Settings.h"
 
 #include "Messages.h"
+#include "SerialOutput.h"
 
 
 void SettingsStore::save(Settings* settings) 
@@ -70,9 +71,9 @@ void SettingsStore::test()
 void Settings::print()
 {
   printMessage(SETTINGS_LOG_INTERVAL_MESSAGE);
-  Serial.println(logIntervalMS);
+  SerialOut.println(logIntervalMS);
   printMessage(SETTINGS_HEIGHT_UNITS_MESSAGE);
-  Serial.println(heightUnits);
+  SerialOut.println(heightUnits);
   printMessage(SETTINGS_BATTERY_TYPE_MESSAGE);
   switch (batteryType)
   {
@@ -87,11 +88,11 @@ void Settings::print()
       break;
   }
   printMessage(SETTINGS_LOW_VOLTAGE_THRESHOLD_MESSAGE);
-  Serial.println(lowVoltageThreshold);
+  SerialOut.println(lowVoltageThreshold);
   printMessage(SETTINGS_BATTERY_MONITOR_CALIBRATION_MESSAGE);
-  Serial.println(batteryMonitorCalibration);
+  SerialOut.println(batteryMonitorCalibration);
   printMessage(SETTINGS_LOG_SERVO_MESSAGE);
-  Serial.println(logServo);
+  SerialOut.println(logServo);
   printMessage(SETTINGS_MID_POSITION_MESSAGE);
   switch (midPositionAction)
   {
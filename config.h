@@ -22,37 +22,90 @@
 //#define SHHHH
 
 // ** Hardware definitions **
+// the I2C bus clock. The BMP085 is good for fast mode, 400kHz.
+#define I2C_CLOCK_HZ 400000
 #define BMP085_XCLR_PIN 17
 #define BMP085_EOC_PIN 16
+// the pin change interrupt for the EOC pin, which must match BMP085_EOC_PIN. Digital pin 16 is PC2,
+// which is PCINT10.
+#define BMP085_EOC_PCMSK PCMSK1
+#define BMP085_EOC_PCINT PCINT10
+#define BMP085_EOC_PCIE PCIE1
+#define BMP085_EOC_vect PCINT1_vect
 #define BEEPER_PIN 3
 #define BATTERY_ANALOG_PIN 6
 #define AT25DF_SS_PIN 10
+// the port and bit of the flash SS pin, which must match AT25DF_SS_PIN. Digital pin 10 is PB2.
+#define AT25DF_SS_PORT PORTB
+#define AT25DF_SS_BIT 2
 #define RADIO_INPUT_PIN 8
 #define SERVO_INPUT_PIN 9
 
 // ** Configuration **
 // -- pressure logging
-// these parameters define the amount of software oversampling applied to temperature and pressure respectively
+// these parameters define the amount of software oversampling applied to temperature and pressure respectively.
+// The pressure oversampling is for one-off readings, like the base pressure: while logging, the pressure is
+// converted continuously and each entry is the average of all the conversions since the last one.
 #define ALTIMETER_OST 20
-#define ALTIMETER_OSP 10
+#define ALTIMETER_OSP 20
+// the temperature changes slowly, so it's only measured this often, and the time saved goes on pressure oversampling
+#define ALTIMETER_TEMPERATURE_INTERVAL_MS 10000
 #define LOG_INTERVAL_MS_DEFAULT 500
+// the conversions are averaged into ticks at LOG_HIGH_RATE_INTERVAL_MS, in ms, and every tick is logged
+// for LOG_HIGH_RATE_TIME after a launch, so that the launch is recorded in detail. The rest of the time
+// the ticks are averaged down again, to the logging interval in the settings in flight, and to
+// LOG_GROUND_INTERVAL_MS on the ground between flights.
+#define LOG_HIGH_RATE_INTERVAL_MS 50
+#define LOG_HIGH_RATE_TIME 10000
+#define LOG_GROUND_INTERVAL_MS 2000
+// how many ticks are kept in RAM on the ground, so that the time just before a launch can be logged at the
+// high rate too once the launch has been detected. Each tick takes five bytes. 16 ticks is 800ms, which is
+// well over the time it takes to detect a launch, and RAM is short.
+#define LOG_PRETRIGGER_LENGTH 16
 // Default height units, in case no valid settings are found: 3.281 for feet, 1.0 for metres. Defaults to feet.
 #define HEIGHT_UNITS_DEFAULT 3.281
 
+// -- SPI bus
+// the SPI clock divider, one of the SPI_CLOCK_DIVn values from SPI.h. The flash can run far faster than
+// the fastest setting.
+#define SPI_CLOCK_DIVIDER SPI_CLOCK_DIV2
+
+// -- datastore
+// the number of flash pages that can be buffered in RAM waiting to be written. Each one costs
+// a page (256 bytes) of RAM. Two is enough for one page to be filling while the other is written.
+#define DATASTORE_WRITE_QUEUE_LENGTH 2
+// uncomment this to run the log as a ring, like a flight recorder: when the flash is full the oldest
+// data is overwritten, a sector at a time, rather than logging stopping. The log never has to be erased
+// by hand, but nothing is kept for good either.
+//#define DATASTORE_RING_MODE
+
 // -- launch detector
 // these parameters tune the launch detector
 // this is the rate of climb that is considered a launch. It's measured in m/s.
-#define LAUNCH_CLIMB_THRESHOLD 3.0
-// this is how long the climb intervals have to exceed the launch climb rate to
+#define LAUNCH_CLIMB_RATE 6.0
+// this is how long the filtered climb rate has to exceed the launch climb rate to
 // trigger the launch detector, measured in ms
-#define LAUNCH_CLIMB_TIME 1500
+#define LAUNCH_CLIMB_TIME 200
 // this is how many samples to seek back after the launch was detected to find the
-// minimum height
-#define LAUNCH_SEEKBACK_SAMPLES 20
+// minimum height. The samples are the log entries, which are LOG_GROUND_INTERVAL_MS apart
+// before a launch.
+#define LAUNCH_SEEKBACK_SAMPLES 5
+// this is how many of the most recent pressure samples are kept in RAM for the height
+// detectors to look back over. It must be at least LAUNCH_SEEKBACK_SAMPLES, and each
+// sample takes two bytes.
+#define PRESSURE_HISTORY_LENGTH 8
 // this is how long the launch window is, in ms. The launch height will be measured in this window.
 #define LAUNCH_WINDOW_TIME 5000
 // the height at which the launch detector re-arms. Measured in meters.
 #define LAUNCH_DETECTOR_REARM_HEIGHT 8.0
+// the climb filter, which the launch detector runs on. It responds like a spring with a natural
+// frequency of 5.6 rad/s, damped to 0.87 of critical. ALPHA is 2 * damping * frequency, and OMEGA2 the
+// frequency squared, both scaled to suit the fixed-point arithmetic (see ClimbFilter.cpp.) Above
+// MAX_STEP_MS, 1 / frequency, the filter follows the readings, and after MAX_GAP_MS it starts again.
+#define CLIMB_FILTER_ALPHA 640
+#define CLIMB_FILTER_OMEGA2 2058
+#define CLIMB_FILTER_MAX_STEP_MS 178
+#define CLIMB_FILTER_MAX_GAP_MS 1000
 
 // -- low voltage alarm
 // default LVA threshold if no valid settings are found.
@@ -84,6 +137,29 @@
 
 // -- serial connection
 #define SERIAL_BAUD_RATE 57600
+// the output is buffered, so that printing doesn't hold up the logging. This must be a power of
+// two, no more than 256, and should have room for at least one download block.
+#define SERIAL_OUTPUT_BUFFER_SIZE 128
+// if the host's RTS line is wired to a pin then it can pause the output, by holding the pin high
+//#define SERIAL_CTS_PIN 4
+// the rates that the host can ask for during a download. They're exact divisions of both 8 and 16MHz clocks.
+#define SERIAL_FAST_BAUD_RATES { 250000, 500000, 1000000 }
+// the host checks a new rate by sending these bytes, which are sent back to it
+#define SERIAL_BAUD_CHECK { 'V', 0x55, 0xaa, 0x0f }
+// a new rate goes back to SERIAL_BAUD_RATE if a download hasn't started this long after it was set, in ms
+#define SERIAL_BAUD_IDLE_TIMEOUT_MS 2000
+// the log is downloaded in blocks of this many bytes
+#define DOWNLOAD_BLOCK_SIZE 64
+// how long to wait for the rest of a binary command, in ms
+#define SERIAL_COMMAND_TIMEOUT_MS 500
+// the framed download sends this many frames ahead of the host's acknowledgements. It must be a power
+// of two, no more than 128, as the frames are kept track of by their 8-bit sequence numbers.
+#define DOWNLOAD_WINDOW 4
+// how long to wait for an acknowledgement before sending the frames again, in ms, and how many
+// times to try before giving up
+#define DOWNLOAD_ACK_TIMEOUT_MS 500
+#define DOWNLOAD_MAX_RETRIES 10
 
 // -- test settings
-#define NUMBER_OF_TEST_LOGS 200
+#define NUMBER_OF_TEST_LOGS 200
+#define NUMBER_OF_TIMING_TEST_SAMPLES 20
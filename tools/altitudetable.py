@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+#
+#    openaltimeter -- an open-source altimeter for RC aircraft
+#    Copyright (C) 2010  Jony Hudson
+#    http://openaltimeter.org
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+"""Generates AltitudeTable.h, the lookup table that BMP085::convertToAltitude() uses instead of pow(),
+and checks how far the firmware's fixed-point conversion is from the formula it replaces.
+
+    altitudetable.py [--output FILE] [--sweep]
+
+The table holds the height, in mm, of a pressure above a standard sea level pressure, every
+2^TABLE_SHIFT Pa. The height above any other base pressure is the difference of two table heights,
+scaled by (standard pressure / base pressure)^(1/5.25), which is worked out when the base pressure
+is set. --sweep runs this module's copy of the firmware arithmetic over the sensor's whole pressure
+range, for a spread of base pressures, and prints the worst error against the floating-point
+formula.
+"""
+
+import argparse
+import os
+
+STANDARD_PRESSURE = 101325
+EXPONENT = 1.0 / 5.25
+TABLE_MIN_PRESSURE = 30000
+TABLE_SHIFT = 9
+# enough entries to reach 110000 Pa, the top of the BMP085's range
+TABLE_LENGTH = ((110000 - TABLE_MIN_PRESSURE) >> TABLE_SHIFT) + 2
+TABLE_MAX_PRESSURE = TABLE_MIN_PRESSURE + ((TABLE_LENGTH - 1) << TABLE_SHIFT)
+SCALE_ONE = 1 << 15
+
+
+def standard_height_mm(pressure):
+    return 44330.0 * (1.0 - (pressure / STANDARD_PRESSURE) ** EXPONENT) * 1000.0
+
+
+def make_table():
+    return [int(round(standard_height_mm(TABLE_MIN_PRESSURE + (i << TABLE_SHIFT))))
+            for i in range(TABLE_LENGTH)]
+
+
+def c_shift(value, bits):
+    # avr-gcc shifts signed values arithmetically, as Python does
+    return value >> bits
+
+
+def lookup(table, pressure):
+    pressure = min(max(pressure, TABLE_MIN_PRESSURE), TABLE_MAX_PRESSURE)
+    offset = pressure - TABLE_MIN_PRESSURE
+    i = offset >> TABLE_SHIFT
+    frac = offset & ((1 << TABLE_SHIFT) - 1)
+    h0 = table[i]
+    if frac == 0:
+        return h0
+    return h0 + c_shift((table[i + 1] - h0) * frac, TABLE_SHIFT)
+
+
+def altitude_scale(base_pressure):
+    return int(round(SCALE_ONE * (STANDARD_PRESSURE / base_pressure) ** EXPONENT))
+
+
+def altitude_mm(table, pressure, base_pressure):
+    """The firmware's BMP085::convertToAltitudeMM()."""
+    base_height = lookup(table, base_pressure)
+    scale = altitude_scale(base_pressure)
+    height = lookup(table, pressure) - base_height
+    # the multiply is split so that nothing overflows 32 bits
+    high = c_shift(height, 8) * scale
+    low = (height & 0xff) * scale
+    result = c_shift(high + c_shift(low, 8), 7)
+    assert -2 ** 31 <= high < 2 ** 31
+    return result
+
+
+def formula_mm(pressure, base_pressure):
+    return 44330.0 * (1.0 - (pressure / base_pressure) ** EXPONENT) * 1000.0
+
+
+def sweep(table):
+    worst = 0.0
+    worst_at = None
+    for base_pressure in range(90000, 106001, 500):
+        for pressure in range(TABLE_MIN_PRESSURE, 110001, 7):
+            error = altitude_mm(table, pressure, base_pressure) - formula_mm(pressure, base_pressure)
+            if abs(error) > abs(worst):
+                worst = error
+                worst_at = (pressure, base_pressure)
+    print('worst error %.1f mm at %d Pa, base pressure %d Pa' % (worst, worst_at[0], worst_at[1]))
+    # the range that RC models fly in
+    worst = 0.0
+    for base_pressure in range(90000, 106001, 500):
+        for pressure in range(base_pressure - 15000, base_pressure + 1001, 3):
+            error = altitude_mm(table, pressure, base_pressure) - formula_mm(pressure, base_pressure)
+            worst = max(worst, abs(error))
+    print('worst error within 15000 Pa of the base pressure %.1f mm' % worst)
+
+
+def write_header(table, path):
+    with open(path, 'w', newline='\n') as f:
+        with open(__file__) as me:
+            licence = [line[1:].rstrip() for line in me.readlines()[2:18]]
+        f.write('/*\n' + '\n'.join(licence) + '\n*/\n\n')
+        f.write('// generated by tools/altitudetable.py, which describes the table. Only BMP085.cpp should include this.\n\n')
+        f.write('#ifndef ALTITUDETABLE_H\n#define ALTITUDETABLE_H\n\n')
+        f.write('#include <avr/pgmspace.h>\n\n')
+        f.write('#define ALTITUDE_TABLE_MIN_PRESSURE %d\n' % TABLE_MIN_PRESSURE)
+        f.write('#define ALTITUDE_TABLE_MAX_PRESSURE %d\n' % TABLE_MAX_PRESSURE)
+        f.write('#define ALTITUDE_TABLE_SHIFT %d\n' % TABLE_SHIFT)
+        f.write('#define ALTITUDE_TABLE_LENGTH %d\n' % TABLE_LENGTH)
+        f.write('#define ALTITUDE_STANDARD_PRESSURE %d\n\n' % STANDARD_PRESSURE)
+        f.write('// the height in mm of each pressure above the standard pressure\n')
+        f.write('int32_t _altitudeTable[ALTITUDE_TABLE_LENGTH] PROGMEM =\n{\n')
+        for start in range(0, TABLE_LENGTH, 8):
+            row = ', '.join('%d' % h for h in table[start:start + 8])
+            f.write('  ' + row + (',' if start + 8 < TABLE_LENGTH else '') + '\n')
+        # the firmware's files end with a CRLF
+        f.write('};\n\n#endif /*ALTITUDETABLE_H*/\r\n')
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Generate and check the altitude lookup table.')
+    parser.add_argument('--output', default=os.path.join(os.path.dirname(os.path.abspath(__file__)), '..',
+                                                         'AltitudeTable.h'))
+    parser.add_argument('--sweep', action='store_true', help='check the conversion instead of writing the table')
+    args = parser.parse_args()
+    table = make_table()
+    if args.sweep:
+        sweep(table)
+    else:
+        write_header(table, args.output)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,419 @@
+#!/usr/bin/env python3
+#
+#    openaltimeter -- an open-source altimeter for RC aircraft
+#    Copyright (C) 2010  Jony Hudson
+#    http://openaltimeter.org
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+"""Reference client for the framed and compressed downloads, which are described in Download.h and
+LogEncoder.h.
+
+This saves the raw log, as it is in the flash, to a file. With the framed download, which is the
+default, the log address of the start of the data is kept in a second file alongside it, with
+.address on the end of its name, so that a download that was broken off can be picked up again with
+--resume. The compressed and raw downloads give the same file as each other, which is the whole log
+followed by two file end markers. The time that the download took is printed at the end, along with
+how long a full flash would take at the same rate. With --fast, the link is switched to a faster rate
+for the download, if the altimeter can do it.
+
+    oadownload.py PORT OUTPUT [--mode framed|compressed|raw] [--resume] [--baud BAUD] [--fast RATE]
+
+It needs pyserial. The protocol code only needs something with read(n) and write(bytes), where
+read() returns fewer bytes than asked for if they don't come in time, so it can be used on other
+sorts of link too.
+"""
+
+import argparse
+import os
+import struct
+import sys
+import time
+
+FRAME_START = 0xa5
+FRAME_HEADER_SIZE = 7
+ACK = b'K'
+NAK = b'N'
+ABORT = b'X'
+# the device gives up after ten timeouts of half a second, so there's no point waiting much longer
+MAX_TIMEOUTS = 10
+
+# the part of the flash that the log goes in
+LOG_DATA_SIZE = 524288 - 2 * 8192
+TAG_FILE_END = 0xff
+TAG_MASK = 0xe0
+TAG_SAMPLE = 0x80
+TAG_EXTENDED = 0xa0
+DELTA_OFFSET = 64
+FIELD_ABSOLUTE_PRESSURE = 0x10
+# the fields that the log encoder sends as "same as last time" or a byte, in the order they're stored
+ENCODED_FIELDS = (0x02, 0x04, 0x08)
+MAX_UNARY = 16
+MAX_RECORD_SIZE = 38
+BAUD_CHECK = bytes([ord('V'), 0x55, 0xaa, 0x0f])
+# how long to leave the device to change rate before checking the new one
+BAUD_CHANGE_DELAY = 0.02
+
+
+def crc16_xmodem(data, crc=0):
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xffff
+    return crc
+
+
+class DownloadError(Exception):
+    pass
+
+
+class CountingPort:
+    """Counts the bytes that come in over the link, and notes when the last one came."""
+    def __init__(self, port):
+        self.port = port
+        self.bytes_read = 0
+        self.last_read_time = time.monotonic()
+
+    def read(self, n):
+        data = self.port.read(n)
+        if data:
+            self.bytes_read += len(data)
+            self.last_read_time = time.monotonic()
+        return data
+
+    def write(self, data):
+        return self.port.write(data)
+
+
+def raise_baud_rate(port, rate, set_rate):
+    """Asks the device to change to a faster rate for the next download, as described by
+    changeBaudRate() in Firmware.pde. set_rate(rate) changes the rate of this end of the link.
+    Returns True if the link is at the new rate, or False if it's still at the old one."""
+    port.write(b'S' + struct.pack('<I', rate))
+    # there might be progress dots from the logging before the reply
+    while True:
+        b = port.read(1)
+        if not b:
+            raise DownloadError('no reply to the baud rate command')
+        if b == b'S':
+            break
+    reply = port.read(4)
+    if len(reply) < 4:
+        raise DownloadError('no reply to the baud rate command')
+    (accepted,) = struct.unpack('<I', reply)
+    if accepted != rate:
+        return False
+    old_rate = set_rate(rate)
+    time.sleep(BAUD_CHANGE_DELAY)
+    port.write(BAUD_CHECK)
+    if port.read(len(BAUD_CHECK)) == BAUD_CHECK:
+        return True
+    # the device goes back to the old rate if it didn't get the check
+    set_rate(old_rate)
+    return False
+
+
+def record_length(tag, extended_length):
+    """The length of a log record, as in Datastore::recordLength()."""
+    if tag & TAG_MASK == TAG_EXTENDED:
+        return min(max(extended_length, 4), MAX_RECORD_SIZE)
+    if tag & TAG_MASK != TAG_SAMPLE:
+        return 1
+    return 3 + (1 if tag & FIELD_ABSOLUTE_PRESSURE else 0) + sum(1 for f in ENCODED_FIELDS if tag & f)
+
+
+def raw_download(port, out, progress=None):
+    """Downloads the whole log with the raw download. There's nothing to say where it ends, apart from
+    the two file end markers, so it finishes when the link goes quiet after them. Returns the number
+    of bytes."""
+    port.write(b'd')
+    total = 0
+    file_ends = 0
+    remaining = 0
+    length_next = False
+    while True:
+        b = port.read(1)
+        if not b:
+            if file_ends >= 2:
+                return total
+            raise DownloadError('the download stopped part way through')
+        out.write(b)
+        total += 1
+        if progress and total % 1024 == 0:
+            progress(total)
+        b = b[0]
+        if length_next:
+            length_next = False
+            remaining = record_length(TAG_EXTENDED, b) - 2
+        elif remaining > 0:
+            remaining -= 1
+        elif b == TAG_FILE_END:
+            file_ends += 1
+        else:
+            file_ends = 0
+            if b & TAG_MASK == TAG_EXTENDED:
+                length_next = True
+            else:
+                remaining = record_length(b, 0) - 1
+
+
+class BitReader:
+    def __init__(self, port):
+        self.port = port
+        self.byte = 0
+        self.count = 0
+
+    def bit(self):
+        if self.count == 0:
+            b = self.port.read(1)
+            if not b:
+                raise DownloadError('the download stopped part way through')
+            self.byte = b[0]
+            self.count = 8
+        self.count -= 1
+        return (self.byte >> self.count) & 1
+
+    def bits(self, n):
+        value = 0
+        for _ in range(n):
+            value = (value << 1) | self.bit()
+        return value
+
+
+def wrap16(value):
+    return ((value + 0x8000) & 0xffff) - 0x8000
+
+
+class LogDecoder:
+    """Undoes the log encoder. This has to follow LogEncoder.cpp exactly."""
+    def __init__(self, bits):
+        self.bits = bits
+        self.pressure = 0
+        self.last_tag = 0
+        self.last_fields = [0] * len(ENCODED_FIELDS)
+        self.rice_sum = 4
+        self.rice_count = 1
+
+    def value(self):
+        k = 0
+        while (self.rice_count << k) < self.rice_sum:
+            k += 1
+        ones = 0
+        while ones < MAX_UNARY and self.bits.bit():
+            ones += 1
+        if ones == MAX_UNARY:
+            folded = self.bits.bits(16)
+        else:
+            folded = (ones << k) | self.bits.bits(k)
+        self.rice_sum += min(folded, 256)
+        self.rice_count += 1
+        if self.rice_count == 16:
+            self.rice_sum >>= 1
+            self.rice_count >>= 1
+        return (folded >> 1) ^ -(folded & 1)
+
+    def sample(self, tag):
+        record = bytearray([tag])
+        if tag & FIELD_ABSOLUTE_PRESSURE:
+            self.pressure = wrap16(self.pressure + self.value())
+            record += struct.pack('<h', self.pressure)
+        else:
+            delta = self.value()
+            self.pressure = wrap16(self.pressure + delta)
+            record.append(delta & 0xff)
+        for i, field in enumerate(ENCODED_FIELDS):
+            if tag & field:
+                if self.bits.bit():
+                    self.last_fields[i] = self.bits.bits(8)
+                record.append(self.last_fields[i])
+        record.append(tag)
+        return bytes(record)
+
+    def next(self):
+        """Returns the bytes for the next code, or None at the end."""
+        if not self.bits.bit():
+            delta = self.value()
+            self.pressure = wrap16(self.pressure + delta)
+            return bytes([delta + DELTA_OFFSET])
+        if not self.bits.bit():
+            return self.sample(self.last_tag)
+        if not self.bits.bit():
+            self.last_tag = TAG_SAMPLE | self.bits.bits(5)
+            return self.sample(self.last_tag)
+        if not self.bits.bit():
+            return bytes([self.bits.bits(8)])
+        return None
+
+
+def compressed_download(port, out, progress=None):
+    """Downloads the whole log with the compressed download. Returns the number of bytes of log."""
+    port.write(b'z')
+    decoder = LogDecoder(BitReader(port))
+    total = 0
+    while True:
+        data = decoder.next()
+        if data is None:
+            return total
+        out.write(data)
+        if progress and (total + len(data)) // 1024 != total // 1024:
+            progress(total + len(data))
+        total += len(data)
+
+
+DAMAGED = 'damaged'
+
+
+def read_frame(port):
+    """Reads the next frame, skipping anything before its start byte. Returns (sequence, address,
+    data), or DAMAGED if the frame was damaged, or None if nothing came in time."""
+    while True:
+        b = port.read(1)
+        if not b:
+            return None
+        if b[0] == FRAME_START:
+            break
+    header = port.read(FRAME_HEADER_SIZE - 1)
+    if len(header) < FRAME_HEADER_SIZE - 1:
+        return DAMAGED
+    sequence, length, address = struct.unpack('<BBI', header)
+    rest = port.read(length + 2)
+    if len(rest) < length + 2:
+        return DAMAGED
+    data = rest[:length]
+    (crc,) = struct.unpack('<H', rest[length:])
+    if crc16_xmodem(header + data) != crc:
+        return DAMAGED
+    return sequence, address, data
+
+
+def framed_download(port, out, from_address=0, progress=None, started=None):
+    """Downloads the log from the given address on, writing the data to out. Returns the address
+    that the data started at, which is the oldest data in the log if from_address was before it.
+    started is called with that address as soon as it's known."""
+    port.write(b'B' + struct.pack('<I', from_address))
+    expected = 0
+    start_address = None
+    next_address = None
+    timeouts = 0
+    while True:
+        frame = read_frame(port)
+        if frame is None:
+            timeouts += 1
+            if timeouts > MAX_TIMEOUTS:
+                raise DownloadError('no reply from the device')
+            port.write(NAK + bytes([expected]))
+            continue
+        timeouts = 0
+        if frame is DAMAGED:
+            sequence = None
+        else:
+            sequence, address, data = frame
+        if sequence != expected:
+            # a frame was damaged or lost. Ask for the frames again from the one we're missing.
+            port.write(NAK + bytes([expected]))
+            continue
+        if start_address is None:
+            # a download can only be picked up again if the data hasn't been overwritten since
+            if from_address != 0 and address != from_address:
+                raise DownloadError('the device started at 0x%x, not 0x%x' % (address, from_address))
+            start_address = next_address = address
+            if started:
+                started(address)
+        if address != next_address:
+            raise DownloadError('expected data at 0x%x, got 0x%x' % (next_address, address))
+        port.write(ACK + bytes([sequence]))
+        expected = (expected + 1) & 0xff
+        if not data:
+            return start_address
+        out.write(data)
+        next_address += len(data)
+        if progress:
+            progress(next_address - start_address)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Download the log from an openaltimeter.')
+    parser.add_argument('port')
+    parser.add_argument('output')
+    parser.add_argument('--mode', choices=('framed', 'compressed', 'raw'), default='framed')
+    parser.add_argument('--resume', action='store_true', help='carry on with a framed download that was broken off')
+    parser.add_argument('--baud', type=int, default=57600)
+    parser.add_argument('--fast', type=int, metavar='RATE', help='the rate to switch to for the download: 250000, 500000 or 1000000')
+    args = parser.parse_args()
+
+    import serial
+    address_file = args.output + '.address'
+    from_address = 0
+    mode = 'wb'
+    if args.resume and args.mode != 'framed':
+        parser.error('only the framed download can be resumed')
+    if args.resume:
+        with open(address_file) as f:
+            first_address = int(f.read(), 0)
+        from_address = first_address + os.path.getsize(args.output)
+        mode = 'ab'
+    serial_port = serial.Serial(args.port, args.baud, timeout=1)
+    serial_port.reset_input_buffer()
+    port = CountingPort(serial_port)
+
+    def set_rate(rate):
+        old_rate = serial_port.baudrate
+        serial_port.baudrate = rate
+        serial_port.reset_input_buffer()
+        return old_rate
+
+    if args.fast:
+        if raise_baud_rate(port, args.fast, set_rate):
+            sys.stderr.write('downloading at %d baud\n' % args.fast)
+        else:
+            sys.stderr.write('the altimeter stayed at %d baud\n' % args.baud)
+    def progress(n):
+        sys.stderr.write('\r%d bytes' % n)
+
+    def started(address):
+        if not args.resume:
+            with open(address_file, 'w') as f:
+                f.write('0x%x\n' % address)
+
+    start_time = time.monotonic()
+    with open(args.output, mode) as out:
+        try:
+            if args.mode == 'raw':
+                total = raw_download(port, out, progress)
+            elif args.mode == 'compressed':
+                total = compressed_download(port, out, progress)
+            else:
+                start = out.tell()
+                framed_download(port, out, from_address, progress, started)
+                total = out.tell() - start
+        except (DownloadError, KeyboardInterrupt):
+            if args.mode == 'framed':
+                port.write(ABORT)
+            raise
+        finally:
+            sys.stderr.write('\n')
+            # the altimeter goes back to its normal rate by itself once the download's over
+            set_rate(args.baud)
+    report(total, port.bytes_read, port.last_read_time - start_time)
+
+
+def report(log_bytes, link_bytes, seconds):
+    print('%d bytes of log in %.1f s, %d bytes over the link' % (log_bytes, seconds, link_bytes))
+    if log_bytes > 0 and seconds > 0:
+        print('a full flash would take about %.0f s at this rate' % (seconds * LOG_DATA_SIZE / log_bytes))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,142 @@
+#!/usr/bin/env python3
+#
+#    openaltimeter -- an open-source altimeter for RC aircraft
+#    Copyright (C) 2010  Jony Hudson
+#    http://openaltimeter.org
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+"""Turns a raw log, as saved by oadownload.py, into a CSV file of its entries, with the time of each
+one rebuilt from the rate records, as described in Datastore.h.
+
+    oalog.py LOG [OUTPUT]
+
+There's a row for each entry, giving the file it's in, its time in seconds from the start of that
+file, and the value of each channel, and a row for each event. The altimeter logs at different rates
+at different times, and when there's a launch it goes back and logs the time just before it again in
+more detail, so within a file the rows are sorted by time, with the detailed entries after the others
+that cover the same time.
+"""
+
+import argparse
+import csv
+import struct
+import sys
+
+from oadownload import TAG_EXTENDED, TAG_FILE_END, TAG_MASK, TAG_SAMPLE, DELTA_OFFSET, \
+    FIELD_ABSOLUTE_PRESSURE, record_length
+
+TAG_PAD = 0x00
+TAG_HEADER = 0xa0
+TAG_EVENT = 0xa1
+TAG_RATE = 0xa3
+# the fields of a sample record after the pressure, in the order they're stored, which are also
+# the channel bits in the header
+FIELDS = (0x02, 0x04, 0x08)
+CHANNEL_NAMES = ('pressure', 'temperature', 'battery', 'servo')
+EVENT_NAMES = {1: 'launch', 2: 'low voltage alarm', 3: 'lost model alarm'}
+
+
+def read_records(data):
+    """Splits the log into its records, stopping at the two file end markers at the end of it."""
+    i = 0
+    while i < len(data):
+        tag = data[i]
+        if tag == TAG_FILE_END and i + 1 < len(data) and data[i + 1] == TAG_FILE_END:
+            return
+        extended_length = data[i + 1] if i + 1 < len(data) else 0
+        length = record_length(tag, extended_length)
+        yield data[i:i + length]
+        i += length
+
+
+def decode(data):
+    """Yields (file, time in ms, channel values, event) for each entry and event in the log. The
+    values are None for an event, and the event is None for an entry."""
+    file_number = 0
+    scaling = {}
+    raw = [0, 0, 0, 0]
+    interval = 0
+    time = None
+    rows = []
+    for record in read_records(data):
+        tag = record[0]
+        if tag == TAG_PAD:
+            continue
+        if tag == TAG_FILE_END:
+            rows.sort(key=lambda row: row[1])
+            yield from rows
+            rows = []
+            file_number += 1
+            time = None
+            continue
+        if tag & TAG_MASK == TAG_EXTENDED:
+            contents = record[2:-2]
+            if tag == TAG_HEADER:
+                channels = contents[1]
+                scaling = {}
+                offset = 2
+                for channel in range(len(CHANNEL_NAMES)):
+                    if channels & (1 << channel):
+                        scaling[channel] = struct.unpack_from('<ff', contents, offset)
+                        offset += 8
+                raw = [0, 0, 0, 0]
+            elif tag == TAG_RATE:
+                interval = struct.unpack_from('<h', contents)[0]
+            elif tag == TAG_EVENT and time is not None:
+                rows.append((file_number, time, None, EVENT_NAMES.get(contents[0], str(contents[0]))))
+            continue
+        if tag < TAG_SAMPLE:
+            raw[0] = (raw[0] + tag - DELTA_OFFSET + 0x8000) % 0x10000 - 0x8000
+        else:
+            i = 1
+            if tag & FIELD_ABSOLUTE_PRESSURE:
+                raw[0] = struct.unpack_from('<h', record, 1)[0]
+                i = 3
+            else:
+                raw[0] = (raw[0] + struct.unpack_from('<b', record, 1)[0] + 0x8000) % 0x10000 - 0x8000
+                i = 2
+            for channel, field in enumerate(FIELDS, 1):
+                if tag & field:
+                    raw[channel] = record[i]
+                    i += 1
+        # the rate is the time from the entry before, so the first entry in a file is at its start
+        time = 0 if time is None else time + interval
+        values = [scaling[c][0] + raw[c] * scaling[c][1] if c in scaling else None
+                  for c in range(len(CHANNEL_NAMES))]
+        rows.append((file_number, time, values, None))
+    rows.sort(key=lambda row: row[1])
+    yield from rows
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Turn a raw openaltimeter log into a CSV file.')
+    parser.add_argument('log')
+    parser.add_argument('output', nargs='?')
+    args = parser.parse_args()
+
+    with open(args.log, 'rb') as f:
+        data = f.read()
+    out = open(args.output, 'w', newline='') if args.output else sys.stdout
+    writer = csv.writer(out)
+    writer.writerow(['file', 'time_s'] + list(CHANNEL_NAMES) + ['event'])
+    for file_number, time, values, event in decode(data):
+        values = ['' if v is None else '%g' % v for v in values or [None] * len(CHANNEL_NAMES)]
+        writer.writerow([file_number, '%.3f' % (time / 1000.0)] + values + [event or ''])
+    if args.output:
+        out.close()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,322 @@
+#!/usr/bin/env python3
+#
+#    openaltimeter -- an open-source altimeter for RC aircraft
+#    Copyright (C) 2010  Jony Hudson
+#    http://openaltimeter.org
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+"""Tests for oadownload.py's framed download, run against a simulated altimeter over a pty.
+
+The simulated device follows the framed download protocol in Download.h. It can be made to damage
+frames, to lose them, or to go quiet for a while, so that the client's CRC check, its NAKs and
+resends, and its timeouts are all exercised. The downloads go through oadownload's main(), with
+--resume for picking up a download that was broken off. pyserial is used if it's installed, and
+otherwise a stand-in that reads and writes the pty directly.
+
+    test_oadownload.py [-v]
+"""
+
+import io
+import os
+import pty
+import random
+import select
+import struct
+import sys
+import tempfile
+import termios
+import threading
+import time
+import tty
+import types
+import unittest
+from contextlib import redirect_stderr, redirect_stdout
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import oadownload
+
+# as in config.h
+BLOCK_SIZE = 64
+WINDOW = 4
+ACK_TIMEOUT = 0.5
+MAX_RETRIES = 10
+
+
+class SimulatedDevice(threading.Thread):
+    """The device end of the framed download, sending log data that starts at the tail address.
+    damage and lose are sets of sequence numbers whose first frame is damaged or not sent, and
+    stall_at is a sequence number before which the device goes quiet for stall_time seconds,
+    ignoring anything that comes in."""
+
+    def __init__(self, fd, log, tail, damage=(), lose=(), stall_at=None, stall_time=0):
+        threading.Thread.__init__(self, daemon=True)
+        self.fd = fd
+        self.log = log
+        self.tail = tail
+        self.damage = set(damage)
+        self.lose = set(lose)
+        self.stall_at = stall_at
+        self.stall_time = stall_time
+        self.naks = []
+        self.ignored = b''
+        self.frames_sent = 0
+        self.running = True
+        self.input = b''
+
+    def stop(self):
+        self.running = False
+        self.join()
+
+    def head(self):
+        return self.tail + len(self.log)
+
+    def read_input(self, timeout):
+        r, _, _ = select.select([self.fd], [], [], timeout)
+        if r:
+            try:
+                self.input += os.read(self.fd, 1024)
+            except OSError:
+                self.running = False
+
+    def take(self, n):
+        while len(self.input) < n and self.running:
+            self.read_input(0.01)
+        data, self.input = self.input[:n], self.input[n:]
+        return data
+
+    def run(self):
+        while self.running:
+            command = self.take(1)
+            if command == b'B':
+                (from_address,) = struct.unpack('<I', self.take(4))
+                self.framed(from_address)
+
+    def send_frame(self, sequence, address):
+        data = self.log[address - self.tail:address - self.tail + BLOCK_SIZE]
+        header = struct.pack('<BBI', sequence, len(data), address)
+        frame = header + data + struct.pack('<H', oadownload.crc16_xmodem(header + data))
+        if sequence in self.lose:
+            self.lose.discard(sequence)
+        else:
+            if sequence in self.damage:
+                self.damage.discard(sequence)
+                # a bit of the data is flipped, or the length if there isn't any
+                frame = bytearray(frame)
+                frame[len(frame) - 3] ^= 0x10
+                frame = bytes(frame)
+            os.write(self.fd, bytes([oadownload.FRAME_START]) + frame)
+        self.frames_sent += 1
+        return address + len(data), not data
+
+    def framed(self, from_address):
+        address = min(max(from_address, self.tail), self.head())
+        base = 0
+        next_sequence = 0
+        frame_addresses = {}
+        end_sent = False
+        last_reply = time.monotonic()
+        retries = 0
+        while self.running:
+            if self.stall_at is not None and next_sequence == self.stall_at:
+                self.stall_at = None
+                time.sleep(self.stall_time)
+                self.read_input(0)
+                self.ignored, self.input = self.input, b''
+                last_reply = time.monotonic()
+            self.read_input(0.001)
+            while len(self.input) >= 2:
+                reply, sequence = self.input[0:1], self.input[1]
+                if reply == oadownload.ABORT:
+                    self.input = self.input[1:]
+                    return
+                if reply not in (oadownload.ACK, oadownload.NAK):
+                    self.input = self.input[1:]
+                    continue
+                self.input = self.input[2:]
+                outstanding = (next_sequence - base) & 0xff
+                acknowledged = (sequence - base + (1 if reply == oadownload.ACK else 0)) & 0xff
+                if acknowledged > outstanding:
+                    continue
+                last_reply = time.monotonic()
+                retries = 0
+                base = (base + acknowledged) & 0xff
+                if end_sent and base == next_sequence:
+                    return
+                if reply == oadownload.NAK:
+                    self.naks.append(sequence)
+                    if next_sequence != base:
+                        address = frame_addresses[base]
+                    next_sequence = base
+                    end_sent = False
+            if not end_sent and ((next_sequence - base) & 0xff) < WINDOW:
+                frame_addresses[next_sequence] = address
+                address, end_sent = self.send_frame(next_sequence, address)
+                next_sequence = (next_sequence + 1) & 0xff
+                last_reply = time.monotonic()
+            elif time.monotonic() - last_reply > ACK_TIMEOUT:
+                retries += 1
+                if retries > MAX_RETRIES:
+                    return
+                if next_sequence != base:
+                    address = frame_addresses[base]
+                next_sequence = base
+                end_sent = False
+                last_reply = time.monotonic()
+
+
+class PtySerial:
+    """Enough of pyserial's Serial for oadownload's main(), on a pty."""
+
+    def __init__(self, path, baudrate, timeout):
+        self.fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+        tty.setraw(self.fd)
+        self.baudrate = baudrate
+        self.timeout = timeout
+
+    def read(self, n):
+        data = b''
+        end = time.monotonic() + self.timeout
+        while len(data) < n:
+            r, _, _ = select.select([self.fd], [], [], max(0, end - time.monotonic()))
+            if not r:
+                break
+            data += os.read(self.fd, n - len(data))
+        return data
+
+    def write(self, data):
+        os.write(self.fd, data)
+        return len(data)
+
+    def reset_input_buffer(self):
+        termios.tcflush(self.fd, termios.TCIFLUSH)
+
+
+def make_log(length, seed):
+    rng = random.Random(seed)
+    return bytes(rng.randrange(256) for _ in range(length))
+
+
+class FramedDownloadTest(unittest.TestCase):
+
+    def setUp(self):
+        self.directory = tempfile.TemporaryDirectory()
+        self.output = os.path.join(self.directory.name, 'log.bin')
+        self.master, slave = pty.openpty()
+        tty.setraw(self.master)
+        self.port = os.ttyname(slave)
+        self.slave = slave
+        self.device = None
+        try:
+            import serial
+        except ImportError:
+            sys.modules['serial'] = types.SimpleNamespace(Serial=PtySerial)
+            self.addCleanup(sys.modules.pop, 'serial')
+
+    def tearDown(self):
+        if self.device:
+            self.device.stop()
+        os.close(self.master)
+        os.close(self.slave)
+        self.directory.cleanup()
+
+    def start_device(self, log, tail, **faults):
+        self.device = SimulatedDevice(self.master, log, tail, **faults)
+        self.device.start()
+
+    def download(self, *extra):
+        argv = sys.argv
+        sys.argv = ['oadownload.py', self.port, self.output] + list(extra)
+        try:
+            with redirect_stdout(io.StringIO()), redirect_stderr(io.StringIO()):
+                oadownload.main()
+        finally:
+            sys.argv = argv
+        with open(self.output, 'rb') as f:
+            return f.read()
+
+    def address(self):
+        with open(self.output + '.address') as f:
+            return int(f.read(), 0)
+
+    def test_clean_download(self):
+        log = make_log(3000, 1)
+        self.start_device(log, 0x1234)
+        self.assertEqual(self.download(), log)
+        self.assertEqual(self.address(), 0x1234)
+        self.assertEqual(self.device.naks, [])
+
+    def test_damaged_frames_are_rejected_and_sent_again(self):
+        log = make_log(3000, 2)
+        self.start_device(log, 0, damage={0, 5, 6, 47})
+        self.assertEqual(self.download(), log)
+        for sequence in (0, 5, 47):
+            self.assertIn(sequence, self.device.naks)
+
+    def test_lost_frames_are_asked_for_again(self):
+        log = make_log(3000, 3)
+        self.start_device(log, 0, lose={2, 10, 11})
+        self.assertEqual(self.download(), log)
+        self.assertIn(2, self.device.naks)
+        self.assertIn(10, self.device.naks)
+
+    def test_damaged_end_frame(self):
+        log = make_log(640, 4)
+        self.start_device(log, 0, damage={10})
+        self.assertEqual(self.download(), log)
+        self.assertIn(10, self.device.naks)
+
+    def test_client_times_out_and_asks_again(self):
+        # the device goes quiet for longer than the client's one second read timeout, and the
+        # client's NAKs from that time are lost, so it has to keep asking until the device is back
+        log = make_log(2000, 5)
+        self.start_device(log, 0, stall_at=8, stall_time=2.5)
+        start = time.monotonic()
+        self.assertEqual(self.download(), log)
+        self.assertGreater(time.monotonic() - start, 2.5)
+        self.assertIn(oadownload.NAK + bytes([8]), self.device.ignored)
+
+    def test_resume_after_a_broken_off_download(self):
+        log = make_log(5000, 6)
+        self.start_device(log, 0x800)
+        self.download()
+        # a download that was broken off leaves the data up to the last good frame
+        with open(self.output, 'r+b') as f:
+            f.truncate(1984)
+        frames = self.device.frames_sent
+        self.assertEqual(self.download('--resume'), log)
+        self.assertEqual(self.address(), 0x800)
+        # only the rest of the log was sent again, along with the end frame
+        self.assertEqual(self.device.frames_sent - frames, (5000 - 1984 + BLOCK_SIZE - 1) // BLOCK_SIZE + 1)
+
+    def test_resume_picks_up_new_data(self):
+        log = make_log(4000, 7)
+        self.start_device(log[:2500], 0)
+        self.assertEqual(self.download(), log[:2500])
+        self.device.log = log
+        self.assertEqual(self.download('--resume'), log)
+
+    def test_resume_fails_if_the_data_has_been_overwritten(self):
+        log = make_log(3000, 8)
+        self.start_device(log, 0)
+        self.download()
+        # the oldest data has gone, so the device starts further on than the client asked for
+        self.device.tail = 4000
+        self.device.log = make_log(1000, 9)
+        with self.assertRaises(oadownload.DownloadError):
+            self.download('--resume')
+
+
+if __name__ == '__main__':
+    unittest.main()